@@ -0,0 +1,170 @@
+#include "acceptor.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+BEGIN_NAMESPACE_LIB
+
+Acceptor::Acceptor (AcceptHandler handler) : m_handler(handler)
+{
+}
+
+Acceptor::~Acceptor ()
+{
+    stop();
+}
+
+void Acceptor::start (const IpAddress& address, int port, int workers, int backlog)
+{
+    if (running()) throw InvalidOperationException("Acceptor was already started");
+
+    if (workers <= 0) workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers <= 0) workers = 1;
+
+    try
+    {
+        for (int n = 0; n < workers; ++n)
+        {
+            Worker* worker = new Worker();
+            worker->owner    = this;
+            worker->listener = 0;
+            worker->spare    = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+            worker->accepted = 0;
+
+            m_workers.push_back(worker);
+
+            worker->listener = new Socket((Socket::AddressFamily)address.family());
+            worker->listener->setReuseAddress(true);
+            worker->listener->setReusePort(true);
+
+            if (address == IpAddress::IPv6Any) worker->listener->setDualMode(true);
+
+            worker->listener->bind(address, port);
+            worker->listener->listen(backlog);
+
+            worker->reactor.add(worker->listener, Socket::SelectRead, Reactor::SocketHandler(worker, &Worker::onAccept));
+        }
+    }
+    catch (...)
+    {
+        stop();
+        throw;
+    }
+
+    for (size_t n = 0; n < m_workers.size(); ++n)
+    {
+        m_workers[n]->thread.setOptions(ThreadOptions(format("acceptor-%d", (int)n)));
+        m_workers[n]->thread.start(m_workers[n], &Worker::run);
+    }
+}
+
+void Acceptor::stop ()
+{
+    for (size_t n = 0; n < m_workers.size(); ++n)
+    {
+        m_workers[n]->reactor.stop();
+    }
+
+    for (size_t n = 0; n < m_workers.size(); ++n)
+    {
+        Worker* worker = m_workers[n];
+
+        if (worker->thread.started()) worker->thread.join();
+
+        if (worker->listener)
+        {
+            worker->reactor.remove(worker->listener);
+            delete worker->listener;
+        }
+
+        if (worker->spare >= 0) ::close(worker->spare);
+
+        delete worker;
+    }
+
+    m_workers.clear();
+}
+
+int64 Acceptor::accepted ()
+{
+    int64 total = 0;
+
+    for (size_t n = 0; n < m_workers.size(); ++n) total += atomic_relaxed(&m_workers[n]->accepted);
+
+    return total;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Acceptor::Worker::run ()
+{
+    reactor.run();
+}
+
+void Acceptor::Worker::onAccept (Socket* socket, int events)
+{
+    // edge-triggered, drain the whole backlog of this listener
+    for (;;)
+    {
+        Socket* client = 0;
+
+        try
+        {
+            client = listener->accept(false);
+        }
+        catch (SocketException&)
+        {
+            int err = errno;
+
+            // the client is gone already, the next ones are still queued
+            if (err == ECONNABORTED || err == EPROTO || err == EINTR) continue;
+
+            // there would be no new edge for the queued connections, they are shed instead
+            if (err == EMFILE || err == ENFILE)
+            {
+                if (shed()) continue;
+                break;
+            }
+
+            logmsg("Acceptor could not accept connection (%d)\n", err);
+            break;
+        }
+
+        if (client == 0) break;
+
+        atomic_add(&accepted, (int64)1);
+
+        if (owner->m_handler.valid()) owner->m_handler.invoke(&reactor, client);
+        else delete client;
+    }
+}
+
+bool Acceptor::Worker::shed ()
+{
+    if (spare < 0)
+    {
+        logmsg("Acceptor is out of descriptors, connections stay queued\n");
+        return false;
+    }
+
+    // frees one descriptor for the pending connection and closes it at once
+    ::close(spare);
+
+    Socket* client = 0;
+
+    try
+    {
+        client = listener->accept(false);
+    }
+    catch (SocketException&)
+    {
+    }
+
+    delete client;
+
+    spare = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    return client != 0;
+}
+
+END_NAMESPACE_LIB
@@ -0,0 +1,64 @@
+#ifndef LIB_ACCEPTOR_H
+#define LIB_ACCEPTOR_H
+
+#include "reactor.h"
+#include "atomic.h"
+
+BEGIN_NAMESPACE_LIB
+
+//////////////////////////////////////////////////////////////////////////
+// Multi-threaded listener, each worker thread owns a listening socket bound
+// to the same port with SO_REUSEPORT and its own reactor, so the kernel
+// spreads incoming connections across the workers without a shared accept
+// queue. Accepted sockets are non-blocking and handed to the handler on the
+// worker thread, the handler takes the ownership and usually adds the socket
+// to the given reactor. When the process runs out of descriptors, pending
+// connections are accepted and closed right away, so the listener never stalls.
+class Acceptor
+{
+public:
+    typedef delegate2<void, Reactor*, Socket*> AcceptHandler;
+
+public:
+    Acceptor (AcceptHandler handler);
+
+    virtual ~Acceptor ();
+
+    // workers defaults to the number of online processors
+    void     start      (const IpAddress& address, int port, int workers = 0, int backlog = 1024);
+
+    void     stop       ();
+
+    bool     running    ()          { return !m_workers.empty(); }
+
+    int      workers    ()          { return (int)m_workers.size(); }
+
+    Reactor* reactor    (int index) { return &m_workers.at(index)->reactor; }
+
+    int64    accepted   ();
+
+protected:
+    struct Worker
+    {
+        Acceptor*       owner;
+        Socket*         listener;
+        Reactor         reactor;
+        Thread          thread;
+        int             spare;      // given up to shed connections when out of descriptors
+        volatile int64  accepted;
+
+        void run      ();
+        void onAccept (Socket* socket, int events);
+
+        // accepts and closes one pending connection, false when there was none to shed
+        bool shed     ();
+    };
+
+protected:
+    AcceptHandler           m_handler;
+    std::vector<Worker*>    m_workers;
+};
+
+END_NAMESPACE_LIB
+
+#endif //LIB_ACCEPTOR_H
@@ -0,0 +1,53 @@
+#ifndef LIB_ATOMIC_H
+#define LIB_ATOMIC_H
+
+#include "types.h"
+
+BEGIN_NAMESPACE_LIB
+
+//////////////////////////////////////////////////////////////////////////
+// Atomic operations on plain integers and pointers with the GCC __atomic
+// builtins. Loads acquire, stores release and read-modify-write operations
+// are sequentially consistent, which covers the lock-free code of the library.
+
+enum { CacheLineSize = 64 };
+
+template <class T>
+inline T    atomic_load     (const volatile T* ptr)             { return __atomic_load_n(ptr, __ATOMIC_ACQUIRE); }
+
+template <class T>
+inline T    atomic_relaxed  (const volatile T* ptr)             { return __atomic_load_n(ptr, __ATOMIC_RELAXED); }
+
+template <class T>
+inline void atomic_store    (volatile T* ptr, T value)          { __atomic_store_n(ptr, value, __ATOMIC_RELEASE); }
+
+// returns the new value
+template <class T>
+inline T    atomic_add      (volatile T* ptr, T value)          { return __atomic_add_fetch(ptr, value, __ATOMIC_SEQ_CST); }
+
+// returns the previous value
+template <class T>
+inline T    atomic_exchange (volatile T* ptr, T value)          { return __atomic_exchange_n(ptr, value, __ATOMIC_SEQ_CST); }
+
+// on failure the current value is stored to expected
+template <class T>
+inline bool atomic_cas      (volatile T* ptr, T* expected, T desired)
+{
+    return __atomic_compare_exchange_n(ptr, expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE);
+}
+
+inline void atomic_fence    ()  { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+
+// hint for spin loops
+inline void cpu_relax       ()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__ ("yield");
+#endif
+}
+
+END_NAMESPACE_LIB
+
+#endif //LIB_ATOMIC_H
@@ -28,71 +28,71 @@ BinaryReader::BinaryReader(const void* data, int size, Endian endian)
 
 char BinaryReader::readChar()
 {
-    char* p = m_buf + m_pos;
-    ensure(1); m_pos++;
+    ensure(1);
+    char* p = m_buf + m_pos; m_pos++;
     return *p;
 }
 
 byte BinaryReader::readByte()
 {
-    char* p = m_buf + m_pos;
-    ensure(1); m_pos++;
+    ensure(1);
+    char* p = m_buf + m_pos; m_pos++;
     return *p;
 }
 
 short BinaryReader::readInt16()
 {
-    char* p = m_buf + m_pos;
-    ensure(2); m_pos += 2;
+    ensure(2);
+    char* p = m_buf + m_pos; m_pos += 2;
     return m_endian.readInt16(p);
 }
 
 ushort BinaryReader::readUInt16()
 {
-    char* p = m_buf + m_pos;
-    ensure(2); m_pos += 2;
+    ensure(2);
+    char* p = m_buf + m_pos; m_pos += 2;
     return m_endian.readUInt16(p);
 }
 
 int BinaryReader::readInt32()
 {
-    char* p = m_buf + m_pos;
-    ensure(4); m_pos += 4;
+    ensure(4);
+    char* p = m_buf + m_pos; m_pos += 4;
     return m_endian.readInt32(p);
 }
 
 uint BinaryReader::readUInt32()
 {
-    char* p = m_buf + m_pos;
-    ensure(4); m_pos += 4;
+    ensure(4);
+    char* p = m_buf + m_pos; m_pos += 4;
     return m_endian.readUInt32(p);
 }
 
 int64 BinaryReader::readInt64()
 {
-    char* p = m_buf + m_pos;
-    ensure(8); m_pos += 8;
+    ensure(8);
+    char* p = m_buf + m_pos; m_pos += 8;
     return m_endian.readInt64(p);
 }
 
 uint64 BinaryReader::readUInt64()
 {
-    char* p = m_buf + m_pos;
-    ensure(8); m_pos += 8;
+    ensure(8);
+    char* p = m_buf + m_pos; m_pos += 8;
     return m_endian.readUInt64(p);
 }
 
 float BinaryReader::readFloat()
 {
-    char* p = m_buf + m_pos;
-    ensure(4); m_pos += 4;
+    ensure(4);
+    char* p = m_buf + m_pos; m_pos += 4;
     return m_endian.readFloat(p);
 }
 
 double BinaryReader::readDouble()
 {
-    char* p = m_buf + m_pos;
-    ensure(8); m_pos += 8;
+    ensure(8);
+    char* p = m_buf + m_pos; m_pos += 8;
     return m_endian.readDouble(p);
 }
 
@@ -1,4 +1,5 @@
 #include "buffer.h"
+#include "scan.h"
 #include <string.h>
 
 BEGIN_NAMESPACE_LIB
@@ -125,12 +126,10 @@ void Buffer::close ()
 
 int Buffer::find (int index, char ch) const
 {
-    for (int n = index; n < m_len; ++n)
-    {
-        if (m_data[n] == ch) return n;
-    }
+    if (index < 0 || index >= m_len) return -1;
 
-    return -1;
+    const char* p = Scan::find(m_data + index, m_data + m_len, ch);
+    return p < m_data + m_len ? (int)(p - m_data) : -1;
 }
 
 int Buffer::findAny(int index, const char* chars) const
@@ -140,15 +139,10 @@ int Buffer::findAny(int index, const char* chars) const
 
 int Buffer::findAny(int index, const char* beg, const char* end) const
 {
-    for (int n = index; n < m_len; ++n)
-    {
-        for (const char* p = beg; p != end; ++p)
-        {
-            if (*p == m_data[n]) return n;
-        }
-    }
+    if (index < 0 || index >= m_len) return -1;
 
-    return -1;
+    const char* p = Scan::findAny(m_data + index, m_data + m_len, beg, (int)(end - beg));
+    return p < m_data + m_len ? (int)(p - m_data) : -1;
 }
 
 int Buffer::copyTo(Buffer& dest, int offset, int pos, int size) const
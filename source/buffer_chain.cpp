@@ -0,0 +1,446 @@
+#include "buffer_chain.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+BEGIN_NAMESPACE_LIB
+
+// memory beyond the largest pool class, coalesced headers are rarely that large
+class HeapBlock : public RefCounted
+{
+public:
+    HeapBlock (int size) : data((char*)malloc(size)) { if (data == 0) throw std::bad_alloc(); }
+
+    char* data;
+
+protected:
+    virtual ~HeapBlock () { ::free(data); }
+};
+
+BufferChain::BufferChain () : m_length(0), m_tailRoom(0)
+{
+}
+
+BufferChain::BufferChain (const BufferChain& other) : Stream(), m_length(0), m_tailRoom(0)
+{
+    *this = other;
+}
+
+BufferChain& BufferChain::operator = (const BufferChain& other)
+{
+    if (this == &other) return *this;
+
+    clear();
+
+    for (size_t n = 0; n < other.m_segments.size(); ++n)
+    {
+        const Segment& seg = other.m_segments[n];
+        if (seg.owner) seg.owner->addRef();
+
+        m_segments.push_back(seg);
+    }
+
+    m_length = other.m_length;
+    other.share();
+
+    return *this;
+}
+
+BufferChain::~BufferChain ()
+{
+    clear();
+}
+
+void BufferChain::append (const void* data, int size)
+{
+    const char* p = (const char*)data;
+
+    while (size > 0)
+    {
+        if (m_tailRoom == 0)
+        {
+            char* block;
+            int room;
+            RefCounted* owner = allocate(size, &block, &room);
+
+            pushBack(owner, block, 0);
+            m_tailRoom = room;
+        }
+
+        Segment& last = m_segments.back();
+        int num = size < m_tailRoom ? size : m_tailRoom;
+
+        memcpy(last.data + last.length, p, num);
+        last.length += num;
+        m_length    += num;
+        m_tailRoom  -= num;
+
+        p    += num;
+        size -= num;
+    }
+}
+
+void BufferChain::append (PooledBuffer* buffer)
+{
+    if (buffer->remaining() == 0) return;
+
+    buffer->addRef();
+    pushBack(buffer, buffer->current(), buffer->remaining());
+}
+
+void BufferChain::appendRef (const void* data, int size)
+{
+    if (size > 0) pushBack(0, (char*)data, size);
+}
+
+void BufferChain::append (BufferChain& other)
+{
+    if (&other == this) throw InvalidArgumentException("Can not append a chain to itself");
+    if (other.empty()) return;
+
+    m_segments.insert(m_segments.end(), other.m_segments.begin(), other.m_segments.end());
+    m_length  += other.m_length;
+    m_tailRoom = other.m_tailRoom;
+
+    other.m_segments.clear();
+    other.m_length   = 0;
+    other.m_tailRoom = 0;
+}
+
+void BufferChain::prepend (const void* data, int size)
+{
+    // from the back, so the blocks end up in order
+    while (size > 0)
+    {
+        int num = size < BufferPool::LargeSize ? size : BufferPool::LargeSize;
+        size -= num;
+
+        char* block;
+        int room;
+        RefCounted* owner = allocate(num, &block, &room);
+
+        memcpy(block, (const char*)data + size, num);
+        pushFront(owner, block, num);
+    }
+}
+
+void BufferChain::prepend (PooledBuffer* buffer)
+{
+    if (buffer->remaining() == 0) return;
+
+    buffer->addRef();
+    pushFront(buffer, buffer->current(), buffer->remaining());
+}
+
+void BufferChain::prepend (BufferChain& other)
+{
+    if (&other == this) throw InvalidArgumentException("Can not prepend a chain to itself");
+    if (other.empty()) return;
+
+    if (empty()) m_tailRoom = other.m_tailRoom;
+
+    m_segments.insert(m_segments.begin(), other.m_segments.begin(), other.m_segments.end());
+    m_length += other.m_length;
+
+    other.m_segments.clear();
+    other.m_length   = 0;
+    other.m_tailRoom = 0;
+}
+
+void BufferChain::split (int count, BufferChain& head)
+{
+    if (&head == this) throw InvalidArgumentException("Can not split a chain into itself");
+    if (count < 0 || count > m_length) throw IndexOutOfRangeException();
+
+    while (count > 0)
+    {
+        Segment& seg = m_segments.front();
+
+        if (seg.length <= count)
+        {
+            // the reference moves along with the segment
+            head.pushBack(seg.owner, seg.data, seg.length);
+            count    -= seg.length;
+            m_length -= seg.length;
+
+            m_segments.pop_front();
+            if (m_segments.empty()) m_tailRoom = 0;
+        }
+        else
+        {
+            // both chains keep a part of the block, only the back part may grow
+            if (seg.owner) seg.owner->addRef();
+            head.pushBack(seg.owner, seg.data, count);
+
+            seg.data   += count;
+            seg.length -= count;
+            m_length   -= count;
+            count = 0;
+        }
+    }
+}
+
+void BufferChain::trimStart (int count)
+{
+    if (count < 0 || count > m_length) throw IndexOutOfRangeException();
+
+    while (count > 0)
+    {
+        Segment& seg = m_segments.front();
+
+        if (seg.length <= count)
+        {
+            count -= seg.length;
+            popFront();
+        }
+        else
+        {
+            seg.data   += count;
+            seg.length -= count;
+            m_length   -= count;
+            count = 0;
+        }
+    }
+}
+
+void BufferChain::trimEnd (int count)
+{
+    if (count < 0 || count > m_length) throw IndexOutOfRangeException();
+
+    while (count > 0)
+    {
+        Segment& seg = m_segments.back();
+
+        if (seg.length <= count)
+        {
+            count -= seg.length;
+            popBack();
+        }
+        else
+        {
+            seg.length -= count;
+            m_length   -= count;
+
+            // the trimmed bytes are free again if the block is ours
+            if (m_tailRoom > 0) m_tailRoom += count;
+            count = 0;
+        }
+    }
+}
+
+const char* BufferChain::coalesce (int count)
+{
+    if (count < 0 || count > m_length) throw IndexOutOfRangeException();
+    if (count == 0) return empty() ? 0 : m_segments.front().data;
+
+    if (m_segments.front().length >= count) return m_segments.front().data;
+
+    char* block;
+    int room;
+    RefCounted* owner = allocate(count, &block, &room);
+
+    peek(block, 0, count);
+    trimStart(count);
+
+    bool last = empty();
+    pushFront(owner, block, count);
+
+    // the rest of the new block is free for appending if nothing follows it
+    if (last) m_tailRoom = room - count;
+
+    return block;
+}
+
+int BufferChain::peek (void* data, int offset, int size) const
+{
+    char* dest = (char*)data;
+    int copied = 0;
+
+    for (size_t n = 0; n < m_segments.size() && copied < size; ++n)
+    {
+        const Segment& seg = m_segments[n];
+
+        if (offset >= seg.length)
+        {
+            offset -= seg.length;
+            continue;
+        }
+
+        int num = seg.length - offset;
+        if (num > size - copied) num = size - copied;
+
+        memcpy(dest + copied, seg.data + offset, num);
+        copied += num;
+        offset  = 0;
+    }
+
+    return copied;
+}
+
+int BufferChain::iovecs (std::vector<iovec>& vec, int maxBytes) const
+{
+    int total = 0;
+
+    for (size_t n = 0; n < m_segments.size(); ++n)
+    {
+        if (maxBytes >= 0 && total >= maxBytes) break;
+
+        int num = m_segments[n].length;
+        if (maxBytes >= 0 && num > maxBytes - total) num = maxBytes - total;
+
+        iovec item = { m_segments[n].data, (size_t)num };
+        vec.push_back(item);
+        total += num;
+    }
+
+    return total;
+}
+
+void BufferChain::writeTo (Stream* stream)
+{
+    std::vector<iovec> vec;
+
+    while (!empty())
+    {
+        vec.clear();
+
+        // writev takes IOV_MAX vectors at most
+        size_t count = m_segments.size() < IOV_MAX ? m_segments.size() : IOV_MAX;
+        int bytes = 0;
+
+        for (size_t n = 0; n < count; ++n)
+        {
+            iovec item = { m_segments[n].data, (size_t)m_segments[n].length };
+            vec.push_back(item);
+            bytes += m_segments[n].length;
+        }
+
+        stream->writevBytes(&vec[0], (int)vec.size());
+        trimStart(bytes);
+    }
+}
+
+int BufferChain::readFrom (Stream* stream, int minRoom)
+{
+    bool added = false;
+
+    if (m_tailRoom < minRoom || m_tailRoom == 0)
+    {
+        char* block;
+        int room;
+        RefCounted* owner = allocate(minRoom > 0 ? minRoom : 1, &block, &room);
+
+        pushBack(owner, block, 0);
+        m_tailRoom = room;
+        added = true;
+    }
+
+    Segment& last = m_segments.back();
+    int num = stream->read(last.data + last.length, 0, m_tailRoom);
+
+    if (num > 0)
+    {
+        last.length += num;
+        m_length    += num;
+        m_tailRoom  -= num;
+    }
+    else if (added)
+    {
+        // no empty segments are left behind
+        popBack();
+    }
+
+    return num;
+}
+
+void BufferChain::clear ()
+{
+    while (!m_segments.empty()) popFront();
+
+    m_tailRoom = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+int BufferChain::read (void* data, int offset, int size)
+{
+    int num = peek((char*)data + offset, 0, size);
+    trimStart(num);
+
+    return num;
+}
+
+int BufferChain::write (const void* data, int offset, int size)
+{
+    append((const char*)data + offset, size);
+    return size;
+}
+
+int BufferChain::writev (const iovec* vec, int count)
+{
+    int total = 0;
+
+    for (int n = 0; n < count; ++n)
+    {
+        append(vec[n].iov_base, (int)vec[n].iov_len);
+        total += (int)vec[n].iov_len;
+    }
+
+    return total;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void BufferChain::pushBack (RefCounted* owner, char* data, int length)
+{
+    Segment seg = { owner, data, length };
+    m_segments.push_back(seg);
+
+    m_length  += length;
+    m_tailRoom = 0;
+}
+
+void BufferChain::pushFront (RefCounted* owner, char* data, int length)
+{
+    Segment seg = { owner, data, length };
+    m_segments.push_front(seg);
+
+    m_length += length;
+}
+
+void BufferChain::popFront ()
+{
+    Segment seg = m_segments.front();
+    m_segments.pop_front();
+    m_length -= seg.length;
+
+    if (m_segments.empty()) m_tailRoom = 0;
+    if (seg.owner) seg.owner->release();
+}
+
+void BufferChain::popBack ()
+{
+    Segment seg = m_segments.back();
+    m_segments.pop_back();
+    m_length -= seg.length;
+
+    m_tailRoom = 0;
+    if (seg.owner) seg.owner->release();
+}
+
+RefCounted* BufferChain::allocate (int size, char** data, int* room)
+{
+    if (size > BufferPool::LargeSize)
+    {
+        HeapBlock* block = new HeapBlock(size);
+        *data = block->data;
+        *room = size;
+        return block;
+    }
+
+    PooledBuffer* buffer = BufferPool::shared()->acquire(size <= BufferPool::MediumSize ? BufferPool::MediumSize : BufferPool::LargeSize);
+    *data = buffer->begin();
+    *room = buffer->size();
+    return buffer;
+}
+
+END_NAMESPACE_LIB
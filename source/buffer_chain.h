@@ -0,0 +1,129 @@
+#ifndef LIB_BUFFER_CHAIN_H
+#define LIB_BUFFER_CHAIN_H
+
+#include "buffer_pool.h"
+
+#include <deque>
+
+BEGIN_NAMESPACE_LIB
+
+//////////////////////////////////////////////////////////////////////////
+// A byte sequence kept as a chain of segments, for framing messages which
+// arrive in pieces. Appending or prepending buffers and other chains links
+// their memory instead of copying it, splitting shares the segment it cuts,
+// and only coalesce copies, when a header spans segments. Bytes written by
+// the chain itself go to blocks of BufferPool::shared().
+//
+// As a Stream, read consumes from the front and write appends, so a
+// BinaryReader or StreamReader parses a chain like any other stream, and
+// iovecs() feeds writev without flattening the chain first.
+class BufferChain : public Stream
+{
+public:
+    BufferChain ();
+
+    // shares the segments, neither chain writes into them afterwards
+    BufferChain (const BufferChain& other);
+
+    BufferChain& operator = (const BufferChain& other);
+
+    virtual ~BufferChain ();
+
+public:
+    bool    empty       ()  const   { return m_length == 0; }
+
+    int     segments    ()  const   { return (int)m_segments.size(); }
+
+    // copies into the free space of the last block, or new blocks
+    void    append      (const void* data, int size);
+
+    // links the readable bytes of the buffer and takes a reference to it
+    void    append      (PooledBuffer* buffer);
+
+    // links memory which stays valid and unchanged until the chain lets go of it
+    void    appendRef   (const void* data, int size);
+
+    // moves the segments of the other chain, which ends up empty
+    void    append      (BufferChain& other);
+
+    void    prepend     (const void* data, int size);
+
+    void    prepend     (PooledBuffer* buffer);
+
+    void    prepend     (BufferChain& other);
+
+    // moves the first count bytes to the end of head
+    void    split       (int count, BufferChain& head);
+
+    // drops bytes from the front or the back
+    void    trimStart   (int count);
+
+    void    trimEnd     (int count);
+
+    // makes the first count bytes contiguous and returns them, copies only if they span segments.
+    // throws IndexOutOfRangeException beyond the length
+    const char* coalesce (int count);
+
+    // copies without consuming, returns the bytes copied
+    int     peek        (void* data, int offset, int size) const;
+
+    // the segments from the front, at most maxBytes or all of them. returns the bytes covered
+    int     iovecs      (std::vector<iovec>& vec, int maxBytes = -1) const;
+
+    // writes and consumes the chain with gather writes
+    void    writeTo     (Stream* stream);
+
+    // reads once from the stream straight into the tail of the chain, returns the bytes read.
+    // room is at least minRoom bytes, up to a pool block
+    int     readFrom    (Stream* stream, int minRoom = 4096);
+
+    void    clear       ();
+
+public: // stream methods
+    virtual bool canRead    ()  { return true;  }
+
+    virtual bool canWrite   ()  { return true;  }
+
+    virtual bool canSeek    ()  { return false; }
+
+    virtual int  read       (void* data, int offset, int size);
+
+    virtual int  write      (const void* data, int offset, int size);
+
+    virtual int  writev     (const iovec* vec, int count);
+
+    virtual int  length     ()  { return m_length; }
+
+    virtual void close      ()  { clear(); }
+
+protected:
+    struct Segment
+    {
+        RefCounted* owner;      // null for memory appended by reference
+        char*       data;
+        int         length;
+    };
+
+    void    pushBack        (RefCounted* owner, char* data, int length);
+
+    void    pushFront       (RefCounted* owner, char* data, int length);
+
+    void    popFront        ();
+
+    void    popBack         ();
+
+    // copies may not write into the shared blocks anymore
+    void    share           () const    { m_tailRoom = 0; }
+
+    // a pool block, or a heap block beyond the largest class
+    RefCounted* allocate    (int size, char** data, int* room);
+
+protected:
+    std::deque<Segment> m_segments;
+    int                 m_length;
+    mutable int         m_tailRoom;     // free bytes after the last segment, in a block only this chain writes
+};
+
+END_NAMESPACE_LIB
+
+#endif //LIB_BUFFER_CHAIN_H
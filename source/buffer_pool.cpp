@@ -0,0 +1,254 @@
+#include "buffer_pool.h"
+#include "atomic.h"
+
+#include <new>
+#include <stdlib.h>
+
+BEGIN_NAMESPACE_LIB
+
+// a chunk is the header, the PooledBuffer object and the data, each 16 byte aligned
+static const int ObjectOffset = 32;
+static const int DataOffset   = (ObjectOffset + (int)sizeof(PooledBuffer) + 15) & ~15;
+
+// slabs are this large unless eight chunks need more
+static const int SlabBytes    = 256 * 1024;
+
+PooledBuffer::PooledBuffer (BufferPool* pool, int sizeClass, char* data, int size)
+  : Buffer(data, size), m_pool(pool), m_class(sizeClass)
+{
+    m_len = 0;
+}
+
+PooledBuffer::~PooledBuffer ()
+{
+}
+
+void PooledBuffer::operator delete (void* p)
+{
+    BufferPool::Chunk* chunk = (BufferPool::Chunk*)((char*)p - ObjectOffset);
+    chunk->pool->recycle(chunk);
+}
+
+//////////////////////////////////////////////////////////////////////////
+BufferPool::BufferPool (int cacheSize) : m_cacheSize(cacheSize > 1 ? cacheSize : 2)
+{
+    pthread_key_create(&m_key, &BufferPool::destroyCache);
+
+    for (int n = 0; n < ClassCount; ++n)
+    {
+        m_free[n]      = 0;
+        m_freeCount[n] = 0;
+        m_chunks[n]    = 0;
+        m_slabCount[n] = 0;
+        m_outside[n]   = 0;
+        m_highWater[n] = 0;
+        m_refills[n]   = 0;
+        m_retired[n]   = 0;
+    }
+}
+
+BufferPool::~BufferPool ()
+{
+    // threads still running keep their key data, it is not ours anymore
+    pthread_key_delete(m_key);
+
+    for (size_t n = 0; n < m_caches.size(); ++n) delete m_caches[n];
+    for (size_t n = 0; n < m_slabs.size(); ++n) ::free(m_slabs[n]);
+}
+
+PooledBuffer* BufferPool::acquire (int size, const Endian& endian)
+{
+    int sizeClass = size <= SmallSize ? Small : (size <= MediumSize ? Medium : Large);
+
+    if (size > LargeSize) throw InvalidArgumentException("Buffer size exceeds the largest pool class");
+
+    ThreadCache* cache = localCache();
+
+    if (cache->chunks[sizeClass] == 0) refill(cache, sizeClass);
+
+    Chunk* chunk = cache->chunks[sizeClass];
+    cache->chunks[sizeClass] = chunk->next;
+    cache->count[sizeClass]--;
+    cache->inUse[sizeClass]++;
+
+    char* base = (char*)chunk;
+    PooledBuffer* buffer = new (base + ObjectOffset) PooledBuffer(this, sizeClass, base + DataOffset, classSize((SizeClass)sizeClass));
+    buffer->setOrder(endian.order());
+
+    return buffer;
+}
+
+BufferPool::Statistics BufferPool::statistics (SizeClass sizeClass)
+{
+    ScopedLock<FastMutex> lock(m_lock);
+
+    Statistics stats;
+    stats.chunkSize = classSize(sizeClass);
+    stats.slabs     = m_slabCount[sizeClass];
+    stats.chunks    = m_chunks[sizeClass];
+    stats.highWater = m_highWater[sizeClass];
+    stats.refills   = m_refills[sizeClass];
+    stats.cached    = 0;
+    stats.inUse     = m_retired[sizeClass];
+
+    // the owners update their caches without the lock, the sums are a snapshot
+    for (size_t n = 0; n < m_caches.size(); ++n)
+    {
+        stats.cached += atomic_relaxed(&m_caches[n]->count[sizeClass]);
+        stats.inUse  += atomic_relaxed(&m_caches[n]->inUse[sizeClass]);
+    }
+
+    return stats;
+}
+
+int BufferPool::classSize (SizeClass sizeClass)
+{
+    static const int sizes[ClassCount] = { SmallSize, MediumSize, LargeSize };
+    return sizes[sizeClass];
+}
+
+BufferPool* BufferPool::shared ()
+{
+    // never deleted, buffers may be released after static destruction
+    static BufferPool* pool = new BufferPool();
+    return pool;
+}
+
+//////////////////////////////////////////////////////////////////////////
+BufferPool::ThreadCache* BufferPool::localCache ()
+{
+    ThreadCache* cache = (ThreadCache*)pthread_getspecific(m_key);
+    if (cache) return cache;
+
+    cache = new ThreadCache();
+    cache->pool = this;
+
+    for (int n = 0; n < ClassCount; ++n)
+    {
+        cache->chunks[n] = 0;
+        cache->count[n]  = 0;
+        cache->inUse[n]  = 0;
+    }
+
+    pthread_setspecific(m_key, cache);
+
+    ScopedLock<FastMutex> lock(m_lock);
+    m_caches.push_back(cache);
+
+    return cache;
+}
+
+void BufferPool::recycle (Chunk* chunk)
+{
+    ThreadCache* cache = localCache();
+    int sizeClass = chunk->sizeClass;
+
+    chunk->next = cache->chunks[sizeClass];
+    cache->chunks[sizeClass] = chunk;
+    cache->count[sizeClass]++;
+    cache->inUse[sizeClass]--;
+
+    // a thread which only releases, like the consumer of a capture thread, hands the surplus back
+    if (cache->count[sizeClass] > m_cacheSize) flush(cache, sizeClass, m_cacheSize / 2);
+}
+
+void BufferPool::refill (ThreadCache* cache, int sizeClass)
+{
+    ScopedLock<FastMutex> lock(m_lock);
+
+    int batch = m_cacheSize / 2;
+
+    if (m_freeCount[sizeClass] < batch) grow(sizeClass);
+
+    for (int n = 0; n < batch && m_free[sizeClass]; ++n)
+    {
+        Chunk* chunk = m_free[sizeClass];
+        m_free[sizeClass] = chunk->next;
+
+        chunk->next = cache->chunks[sizeClass];
+        cache->chunks[sizeClass] = chunk;
+
+        cache->count[sizeClass]++;
+        m_freeCount[sizeClass]--;
+        m_outside[sizeClass]++;
+    }
+
+    if (m_outside[sizeClass] > m_highWater[sizeClass]) m_highWater[sizeClass] = m_outside[sizeClass];
+
+    m_refills[sizeClass]++;
+}
+
+void BufferPool::flush (ThreadCache* cache, int sizeClass, int keep)
+{
+    ScopedLock<FastMutex> lock(m_lock);
+
+    while (cache->count[sizeClass] > keep)
+    {
+        Chunk* chunk = cache->chunks[sizeClass];
+        cache->chunks[sizeClass] = chunk->next;
+
+        chunk->next = m_free[sizeClass];
+        m_free[sizeClass] = chunk;
+
+        cache->count[sizeClass]--;
+        m_freeCount[sizeClass]++;
+        m_outside[sizeClass]--;
+    }
+}
+
+void BufferPool::grow (int sizeClass)
+{
+    int stride = chunkStride(sizeClass);
+    int count  = SlabBytes / stride;
+    if (count < 8) count = 8;
+
+    void* slab = 0;
+    if (posix_memalign(&slab, CacheLineSize, (size_t)stride * count) != 0) throw std::bad_alloc();
+
+    m_slabs.push_back((char*)slab);
+    m_slabCount[sizeClass]++;
+    m_chunks[sizeClass] += count;
+
+    for (int n = count - 1; n >= 0; --n)
+    {
+        Chunk* chunk = (Chunk*)((char*)slab + (size_t)n * stride);
+        chunk->pool      = this;
+        chunk->sizeClass = sizeClass;
+        chunk->next      = m_free[sizeClass];
+
+        m_free[sizeClass] = chunk;
+        m_freeCount[sizeClass]++;
+    }
+}
+
+void BufferPool::destroyCache (void* p)
+{
+    ThreadCache* cache = (ThreadCache*)p;
+    BufferPool* pool = cache->pool;
+
+    for (int n = 0; n < ClassCount; ++n) pool->flush(cache, n, 0);
+
+    ScopedLock<FastMutex> lock(pool->m_lock);
+
+    // the buffers the thread left acquired, or released for others, stay counted
+    for (int n = 0; n < ClassCount; ++n) pool->m_retired[n] += cache->inUse[n];
+
+    for (size_t n = 0; n < pool->m_caches.size(); ++n)
+    {
+        if (pool->m_caches[n] == cache)
+        {
+            pool->m_caches.erase(pool->m_caches.begin() + n);
+            break;
+        }
+    }
+
+    delete cache;
+}
+
+int BufferPool::chunkStride (int sizeClass)
+{
+    // whole cache lines, so neighbouring chunks used by different threads share none
+    return (DataOffset + classSize((SizeClass)sizeClass) + CacheLineSize - 1) & ~(CacheLineSize - 1);
+}
+
+END_NAMESPACE_LIB
@@ -0,0 +1,149 @@
+#ifndef LIB_BUFFER_POOL_H
+#define LIB_BUFFER_POOL_H
+
+#include "buffer.h"
+#include "smart.h"
+#include "thread.h"
+
+#include <pthread.h>
+
+BEGIN_NAMESPACE_LIB
+
+class BufferPool;
+
+//////////////////////////////////////////////////////////////////////////
+// A fixed size Buffer on a chunk of a BufferPool slab, handed out with one
+// reference. The last release returns the chunk to the pool instead of the
+// heap, from any thread.
+class PooledBuffer : public Buffer, public RefCounted
+{
+public:
+    BufferPool* pool        ()  const   { return m_pool; }
+
+    int         sizeClass   ()  const   { return m_class; }
+
+    // the object lives inside the chunk, deleting it recycles the chunk
+    static void operator delete (void* p);
+
+protected:
+    PooledBuffer (BufferPool* pool, int sizeClass, char* data, int size);
+
+    virtual ~PooledBuffer ();
+
+protected:
+    BufferPool* m_pool;
+    int         m_class;
+
+    friend class BufferPool;
+
+private:
+    PooledBuffer (const PooledBuffer&);
+    PooledBuffer& operator = (const PooledBuffer&);
+};
+
+typedef RefCountedPtr<PooledBuffer> PooledBufferPtr;
+
+//////////////////////////////////////////////////////////////////////////
+// Slab allocator for packet buffers. Each size class carves its chunks from
+// large slabs, every chunk holding the PooledBuffer object and its data, so
+// acquire and release touch neither malloc nor a shared lock in the common
+// case: each thread keeps a small cache per class and only goes to the
+// central lists, under a lock, for a batch at a time.
+//
+// Slabs are kept until the pool is deleted, which has to wait until all its
+// buffers are released. shared() is never deleted.
+class BufferPool
+{
+public:
+    // one TS packet, seven TS packets in a UDP/RTP datagram, the largest datagram
+    enum SizeClass { Small, Medium, Large, ClassCount };
+
+    enum { SmallSize = 188, MediumSize = 1316, LargeSize = 65536 };
+
+    enum { DefaultCacheSize = 32 };
+
+    struct Statistics
+    {
+        int     chunkSize;      // the capacity of its buffers
+        int     slabs;
+        int     chunks;         // carved from the slabs so far
+        int     inUse;          // acquired and not released yet
+        int     cached;         // held by the thread caches
+        int     highWater;      // the most chunks in use or cached at once
+        int64   refills;        // trips of the thread caches to the central lists
+    };
+
+public:
+    // cacheSize chunks per class and thread at most
+    BufferPool (int cacheSize = DefaultCacheSize);
+
+    virtual ~BufferPool ();
+
+    // a buffer of the smallest class holding size bytes, empty and with one reference.
+    // throws InvalidArgumentException beyond LargeSize
+    PooledBuffer*   acquire     (int size, const Endian& endian = Endian::Default);
+
+    Statistics      statistics  (SizeClass sizeClass);
+
+    static int      classSize   (SizeClass sizeClass);
+
+    static BufferPool* shared   ();
+
+protected:
+    // the header in front of every PooledBuffer, links the free chunks
+    struct Chunk
+    {
+        Chunk*      next;
+        BufferPool* pool;
+        int         sizeClass;
+    };
+
+    struct ThreadCache
+    {
+        BufferPool* pool;
+        Chunk*      chunks  [ClassCount];
+        int         count   [ClassCount];
+        int         inUse   [ClassCount];   // negative when released on another thread
+    };
+
+    ThreadCache*    localCache  ();
+
+    void            recycle     (Chunk* chunk);
+
+    void            refill      (ThreadCache* cache, int sizeClass);
+
+    void            flush       (ThreadCache* cache, int sizeClass, int keep);
+
+    void            grow        (int sizeClass);
+
+    static void     destroyCache (void* cache);
+
+    static int      chunkStride (int sizeClass);
+
+protected:
+    int                         m_cacheSize;
+    pthread_key_t               m_key;
+    FastMutex                   m_lock;         // guards everything below
+
+    Chunk*                      m_free      [ClassCount];
+    int                         m_freeCount [ClassCount];
+    int                         m_chunks    [ClassCount];
+    int                         m_slabCount [ClassCount];
+    int                         m_outside   [ClassCount];   // in use or cached
+    int                         m_highWater [ClassCount];
+    int64                       m_refills   [ClassCount];
+    int                         m_retired   [ClassCount];   // inUse of the caches of finished threads
+
+    std::vector<char*>          m_slabs;
+    std::vector<ThreadCache*>   m_caches;
+
+    friend class PooledBuffer;
+
+private:
+    BufferPool (const BufferPool&);
+    BufferPool& operator = (const BufferPool&);
+};
+
+END_NAMESPACE_LIB
+
+#endif //LIB_BUFFER_POOL_H
@@ -0,0 +1,229 @@
+#ifndef LIB_BUFFER_VIEW_H
+#define LIB_BUFFER_VIEW_H
+
+#include "buffer.h"
+
+#include <string.h>
+
+BEGIN_NAMESPACE_LIB
+
+//////////////////////////////////////////////////////////////////////////
+// Byte order fixed at compile time: the swap of the native order compiles
+// away, the other one is a single bswap. Loads and stores go through memcpy,
+// which compiles to plain moves and does not care for alignment.
+template <ByteOrder Order>
+struct ByteOrderOf
+{
+    enum { Swap = Order != DefaultEndian };
+
+    static inline uint16 load16  (const char* p)    { uint16 v; memcpy(&v, p, 2); return Swap ? bswap_16(v) : v; }
+
+    static inline uint32 load32  (const char* p)    { uint32 v; memcpy(&v, p, 4); return Swap ? bswap_32(v) : v; }
+
+    static inline uint64 load64  (const char* p)    { uint64 v; memcpy(&v, p, 8); return Swap ? bswap_64(v) : v; }
+
+    static inline void   store16 (char* p, uint16 v)    { if (Swap) v = bswap_16(v); memcpy(p, &v, 2); }
+
+    static inline void   store32 (char* p, uint32 v)    { if (Swap) v = bswap_32(v); memcpy(p, &v, 4); }
+
+    static inline void   store64 (char* p, uint64 v)    { if (Swap) v = bswap_64(v); memcpy(p, &v, 8); }
+};
+
+//////////////////////////////////////////////////////////////////////////
+// Unchecked reads over a record whose size was checked once, handed out by
+// BufferView::record. Nothing is virtual, so a header parse inlines to a
+// few loads. Floats keep the native order like Buffer and Endian, only
+// integers are swapped.
+template <ByteOrder Order>
+class BinaryCursor
+{
+public:
+    typedef ByteOrderOf<Order> Bytes;
+
+    BinaryCursor (const char* data, int size) : m_begin(data), m_ptr(data), m_end(data + size) { }
+
+    const char* current     ()  const   { return m_ptr; }
+
+    int         position    ()  const   { return (int)(m_ptr - m_begin); }
+
+    int         remaining   ()  const   { return (int)(m_end - m_ptr); }
+
+    void        skip        (int count) { m_ptr += count; }
+
+    byte        readByte    ()  { return (byte)*m_ptr++; }
+
+    char        readChar    ()  { return *m_ptr++; }
+
+    ushort      readUInt16  ()  { uint16 v = Bytes::load16(m_ptr); m_ptr += 2; return v; }
+
+    short       readInt16   ()  { return (short)readUInt16(); }
+
+    uint        readUInt32  ()  { uint32 v = Bytes::load32(m_ptr); m_ptr += 4; return v; }
+
+    int         readInt32   ()  { return (int)readUInt32(); }
+
+    uint64      readUInt64  ()  { uint64 v = Bytes::load64(m_ptr); m_ptr += 8; return v; }
+
+    int64       readInt64   ()  { return (int64)readUInt64(); }
+
+    float       readFloat   ()  { float f; memcpy(&f, m_ptr, 4); m_ptr += 4; return f; }
+
+    double      readDouble  ()  { double d; memcpy(&d, m_ptr, 8); m_ptr += 8; return d; }
+
+    void        readBytes   (void* data, int size)  { memcpy(data, m_ptr, size); m_ptr += size; }
+
+
+    byte        peekByte    (int offset = 0) const  { return (byte)m_ptr[offset]; }
+
+    ushort      peekUInt16  (int offset = 0) const  { return Bytes::load16(m_ptr + offset); }
+
+    uint        peekUInt32  (int offset = 0) const  { return Bytes::load32(m_ptr + offset); }
+
+    uint64      peekUInt64  (int offset = 0) const  { return Bytes::load64(m_ptr + offset); }
+
+protected:
+    const char* m_begin;
+    const char* m_ptr;
+    const char* m_end;
+};
+
+//////////////////////////////////////////////////////////////////////////
+// Unchecked writes into space reserved once, appended to the buffer when
+// the appender goes out of scope.
+template <ByteOrder Order>
+class BinaryAppender
+{
+public:
+    typedef ByteOrderOf<Order> Bytes;
+
+    BinaryAppender (Buffer& buffer, int size) : m_buffer(buffer)
+    {
+        buffer.reserve(buffer.length() + size);
+        m_ptr = m_begin = buffer.end();
+    }
+
+    ~BinaryAppender ()  { m_buffer.extendLen((int)(m_ptr - m_begin)); }
+
+    int         written     ()  const   { return (int)(m_ptr - m_begin); }
+
+    void        writeByte   (byte value)    { *m_ptr++ = (char)value; }
+
+    void        writeChar   (char value)    { *m_ptr++ = value; }
+
+    void        writeUInt16 (ushort value)  { Bytes::store16(m_ptr, value); m_ptr += 2; }
+
+    void        writeInt16  (short value)   { writeUInt16((ushort)value); }
+
+    void        writeUInt32 (uint value)    { Bytes::store32(m_ptr, value); m_ptr += 4; }
+
+    void        writeInt32  (int value)     { writeUInt32((uint)value); }
+
+    void        writeUInt64 (uint64 value)  { Bytes::store64(m_ptr, value); m_ptr += 8; }
+
+    void        writeInt64  (int64 value)   { writeUInt64((uint64)value); }
+
+    void        writeFloat  (float value)   { memcpy(m_ptr, &value, 4); m_ptr += 4; }
+
+    void        writeDouble (double value)  { memcpy(m_ptr, &value, 8); m_ptr += 8; }
+
+    void        writeBytes  (const void* data, int size)    { memcpy(m_ptr, data, size); m_ptr += size; }
+
+protected:
+    Buffer&     m_buffer;
+    char*       m_begin;
+    char*       m_ptr;
+
+private:
+    BinaryAppender (const BinaryAppender&);
+    BinaryAppender& operator = (const BinaryAppender&);
+};
+
+//////////////////////////////////////////////////////////////////////////
+// A non-owning, non-virtual reader over contiguous bytes with the byte
+// order in its type, for parsers which decode millions of fields per
+// second. record() checks the bounds of a whole record once and returns a
+// cursor reading its fields unchecked; the readXxx here check each field,
+// like Buffer does. The memory has to outlive the view.
+template <ByteOrder Order>
+class BufferView
+{
+public:
+    typedef BinaryCursor<Order>     Cursor;
+    typedef ByteOrderOf<Order>      Bytes;
+
+    BufferView (const void* data, int size) : m_data((const char*)data), m_size(size), m_pos(0) { }
+
+    // the bytes from the position of the buffer to its length
+    explicit BufferView (const Buffer& buffer) : m_data(buffer.current()), m_size(buffer.remaining()), m_pos(0) { }
+
+    const char* begin       ()  const   { return m_data; }
+
+    const char* current     ()  const   { return m_data + m_pos; }
+
+    int         size        ()  const   { return m_size; }
+
+    int         position    ()  const   { return m_pos; }
+
+    void        setPosition (int pos)   { if (pos < 0 || pos > m_size) throw IndexOutOfRangeException(); m_pos = pos; }
+
+    int         remaining   ()  const   { return m_size - m_pos; }
+
+    bool        has         (int count) const   { return count <= m_size - m_pos; }
+
+    void        skip        (int count) { check(count); m_pos += count; }
+
+    // one bounds check for the next size bytes, which the view moves past
+    Cursor      record      (int size)  { check(size); Cursor cursor(m_data + m_pos, size); m_pos += size; return cursor; }
+
+    // the same without moving past them
+    Cursor      peekRecord  (int size) const    { check(size); return Cursor(m_data + m_pos, size); }
+
+
+    byte        readByte    ()  { check(1); return (byte)m_data[m_pos++]; }
+
+    char        readChar    ()  { check(1); return m_data[m_pos++]; }
+
+    ushort      readUInt16  ()  { check(2); uint16 v = Bytes::load16(m_data + m_pos); m_pos += 2; return v; }
+
+    short       readInt16   ()  { return (short)readUInt16(); }
+
+    uint        readUInt32  ()  { check(4); uint32 v = Bytes::load32(m_data + m_pos); m_pos += 4; return v; }
+
+    int         readInt32   ()  { return (int)readUInt32(); }
+
+    uint64      readUInt64  ()  { check(8); uint64 v = Bytes::load64(m_data + m_pos); m_pos += 8; return v; }
+
+    int64       readInt64   ()  { return (int64)readUInt64(); }
+
+    float       readFloat   ()  { check(4); float f; memcpy(&f, m_data + m_pos, 4); m_pos += 4; return f; }
+
+    double      readDouble  ()  { check(8); double d; memcpy(&d, m_data + m_pos, 8); m_pos += 8; return d; }
+
+    void        readBytes   (void* data, int size)  { check(size); memcpy(data, m_data + m_pos, size); m_pos += size; }
+
+    string      readString  (int size)  { check(size); string s(m_data + m_pos, size); m_pos += size; return s; }
+
+
+    byte        peekByte    (int offset = 0) const  { check(offset + 1); return (byte)m_data[m_pos + offset]; }
+
+    ushort      peekUInt16  (int offset = 0) const  { check(offset + 2); return Bytes::load16(m_data + m_pos + offset); }
+
+    uint        peekUInt32  (int offset = 0) const  { check(offset + 4); return Bytes::load32(m_data + m_pos + offset); }
+
+    uint64      peekUInt64  (int offset = 0) const  { check(offset + 8); return Bytes::load64(m_data + m_pos + offset); }
+
+protected:
+    void        check       (int count) const   { if (count < 0 || count > m_size - m_pos) throw IndexOutOfRangeException(); }
+
+protected:
+    const char* m_data;
+    int         m_size;
+    int         m_pos;
+};
+
+typedef BufferView<BigEndian>       BigEndianView;
+typedef BufferView<LittleEndian>    LittleEndianView;
+
+END_NAMESPACE_LIB
+
+#endif //LIB_BUFFER_VIEW_H
@@ -0,0 +1,200 @@
+#include "connection_pool.h"
+#include "utils.h"
+
+BEGIN_NAMESPACE_LIB
+
+ConnectionPool::ConnectionPool (int maxIdle, int idleTimeout)
+  : m_maxIdle(maxIdle), m_idleTimeout(idleTimeout), m_hits(0), m_misses(0), m_evictions(0)
+{
+}
+
+ConnectionPool::~ConnectionPool ()
+{
+    clear();
+}
+
+ConnectionPool* ConnectionPool::shared ()
+{
+    static ConnectionPool pool;
+    return &pool;
+}
+
+string ConnectionPool::keyOf (const string& host, int port)
+{
+    return format("%s:%d", toLower(host).c_str(), port);
+}
+
+bool ConnectionPool::healthy (Socket* socket)
+{
+    if (!socket->connected()) return false;
+
+    try
+    {
+        // nothing may be readable on an idle connection, EOF means the peer closed
+        // its side and pending data would desynchronize the next exchange
+        return !socket->poll(0, Socket::SelectRead);
+    }
+    catch (...)
+    {
+        return false;
+    }
+}
+
+Socket* ConnectionPool::lease (const string& host, int port, int connectTimeout)
+{
+    string key = keyOf(host, port);
+    int64 limit = tickcount_us() - (int64)m_idleTimeout * 1000;
+
+    AutoLock lock(m_lock);
+
+    IdleMap::iterator it = m_idle.find(key);
+
+    while (it != m_idle.end() && !it->second.empty())
+    {
+        Socket* socket = it->second.back().socket;
+        int64   since  = it->second.back().since;
+        it->second.pop_back();
+
+        // the backend has likely timed the connection out even if its FIN is not here yet
+        if (since > limit && healthy(socket))
+        {
+            m_hits++;
+            m_leased[socket] = key;
+            return socket;
+        }
+
+        m_evictions++;
+        delete socket;
+    }
+
+    m_misses++;
+
+    lock.unlock();
+
+    Socket* socket = NetworkStream::connect(host, port, connectTimeout);
+
+    try
+    {
+        socket->setKeepAlive(true, KeepAliveIdle, KeepAliveInterval, KeepAliveCount);
+    }
+    catch (...)
+    {
+        delete socket;
+        throw;
+    }
+
+    lock.lock();
+    m_leased[socket] = key;
+
+    return socket;
+}
+
+void ConnectionPool::giveBack (Socket* socket, bool reusable)
+{
+    if (socket == 0) return;
+
+    AutoLock lock(m_lock);
+
+    LeaseMap::iterator leased = m_leased.find(socket);
+
+    if (leased == m_leased.end())
+    {
+        throw InvalidArgumentException("The socket was not leased from this pool");
+    }
+
+    string key = leased->second;
+    m_leased.erase(leased);
+
+    if (reusable && healthy(socket))
+    {
+        IdleList& list = m_idle[key];
+
+        if ((int)list.size() >= m_maxIdle)
+        {
+            // keep the warm connections, close the one idle for the longest time
+            delete list.front().socket;
+            list.pop_front();
+            m_evictions++;
+        }
+
+        Idle idle = { socket, tickcount_us() };
+        list.push_back(idle);
+    }
+    else
+    {
+        if (reusable) m_evictions++;
+        delete socket;
+    }
+}
+
+int ConnectionPool::evictIdle ()
+{
+    int64 limit = tickcount_us() - (int64)m_idleTimeout * 1000;
+    int count = 0;
+
+    AutoLock lock(m_lock);
+
+    for (IdleMap::iterator it = m_idle.begin(); it != m_idle.end(); )
+    {
+        IdleList& list = it->second;
+
+        // ordered by the time given back, oldest first
+        while (!list.empty() && list.front().since <= limit)
+        {
+            delete list.front().socket;
+            list.pop_front();
+            count++;
+        }
+
+        if (list.empty()) m_idle.erase(it++);
+        else ++it;
+    }
+
+    m_evictions += count;
+
+    return count;
+}
+
+void ConnectionPool::clear ()
+{
+    AutoLock lock(m_lock);
+
+    for (IdleMap::iterator it = m_idle.begin(); it != m_idle.end(); ++it)
+    {
+        for (size_t n = 0; n < it->second.size(); ++n) delete it->second[n].socket;
+    }
+
+    m_idle.clear();
+}
+
+int ConnectionPool::idleCount ()
+{
+    AutoLock lock(m_lock);
+
+    int count = 0;
+
+    for (IdleMap::iterator it = m_idle.begin(); it != m_idle.end(); ++it) count += (int)it->second.size();
+
+    return count;
+}
+
+//////////////////////////////////////////////////////////////////////////
+PooledStream::PooledStream (ConnectionPool* pool, const string& host, int port, int connectTimeout)
+  : NetworkStream(pool->lease(host, port, connectTimeout), false), m_pool(pool), m_reusable(true)
+{
+}
+
+PooledStream::~PooledStream ()
+{
+    close();
+}
+
+void PooledStream::close ()
+{
+    Socket* socket = m_socket;
+    m_socket = 0;
+
+    if (socket) m_pool->giveBack(socket, m_reusable);
+}
+
+END_NAMESPACE_LIB
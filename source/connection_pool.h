@@ -0,0 +1,101 @@
+#ifndef LIB_CONNECTION_POOL_H
+#define LIB_CONNECTION_POOL_H
+
+#include "socket.h"
+#include "thread.h"
+
+#include <map>
+#include <deque>
+
+BEGIN_NAMESPACE_LIB
+
+//////////////////////////////////////////////////////////////////////////
+// Keeps idle outbound connections keyed by host and port. Pooled sockets have
+// TCP keep-alive enabled so dead peers surface while idle, and every socket is
+// checked again when leased and when given back: a readable idle connection
+// has either been closed by the peer or carries unexpected data, and is
+// dropped, like one idle for longer than the idle timeout. The most recently
+// used connection is leased first. Thread safe.
+class ConnectionPool
+{
+public:
+    enum { DefaultMaxIdle = 8, DefaultIdleTimeout = 60000, KeepAliveIdle = 30, KeepAliveInterval = 5, KeepAliveCount = 3 };
+
+public:
+    // idleTimeout is in milliseconds, maxIdle is per host and port
+    ConnectionPool (int maxIdle = DefaultMaxIdle, int idleTimeout = DefaultIdleTimeout);
+
+    virtual ~ConnectionPool ();
+
+    // returns a pooled connection or connects a new one, the caller owns it until giveBack
+    Socket* lease       (const string& host, int port, int connectTimeout = 15000);
+
+    // pass reusable = false after errors or when the exchange was not completed
+    void    giveBack    (Socket* socket, bool reusable = true);
+
+    // closes the connections idle longer than the idle timeout, returns the number closed
+    int     evictIdle   ();
+
+    void    clear       ();
+
+    int     idleCount   ();
+
+    int64   hits        ()  { return m_hits;      }
+
+    int64   misses      ()  { return m_misses;    }
+
+    int64   evictions   ()  { return m_evictions; }
+
+    static ConnectionPool* shared ();
+
+protected:
+    struct Idle
+    {
+        Socket*     socket;
+        int64       since;
+    };
+
+    typedef std::deque<Idle>                IdleList;
+    typedef std::map<string, IdleList>      IdleMap;
+    typedef std::map<Socket*, string>       LeaseMap;
+
+    static string   keyOf   (const string& host, int port);
+
+    static bool     healthy (Socket* socket);
+
+protected:
+    Mutex       m_lock;
+    IdleMap     m_idle;
+    LeaseMap    m_leased;
+
+    int         m_maxIdle;
+    int         m_idleTimeout;
+
+    int64       m_hits;
+    int64       m_misses;
+    int64       m_evictions;
+};
+
+//////////////////////////////////////////////////////////////////////////
+// NetworkStream over a leased connection, the connection is given back to the
+// pool on close unless discard() was called
+class PooledStream : public NetworkStream
+{
+public:
+    PooledStream (ConnectionPool* pool, const string& host, int port, int connectTimeout = 15000);
+
+    virtual ~PooledStream ();
+
+    // the connection is closed instead of reused, call it when the exchange failed
+    void discard ()     { m_reusable = false; }
+
+    virtual void close ();
+
+protected:
+    ConnectionPool* m_pool;
+    bool            m_reusable;
+};
+
+END_NAMESPACE_LIB
+
+#endif //LIB_CONNECTION_POOL_H
@@ -0,0 +1,286 @@
+#include "connector.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <errno.h>
+
+#ifdef WIN32
+#define connector_poll WSAPoll
+#else
+#define connector_poll ::poll
+#endif
+
+BEGIN_NAMESPACE_LIB
+
+static void set_socket_error (int err)
+{
+#ifdef WIN32
+    WSASetLastError(err);
+#else
+    errno = err;
+#endif
+}
+
+static bool contains (const IpAddresses& addresses, const IpAddress& address)
+{
+    return std::find(addresses.begin(), addresses.end(), address) != addresses.end();
+}
+
+Connector::Connector (int stagger) : m_stagger(stagger)
+{
+}
+
+Socket* Connector::connect (const IpAddresses& addresses, int port, int timeout)
+{
+    if (addresses.empty()) throw InvalidArgumentException("No address to connect");
+
+    m_attempts.clear();
+
+    std::vector<Socket*> sockets;   // by attempt, null once finished
+    std::vector<int64>   started;
+
+    int64  now       = tickcount_us();
+    int64  deadline  = timeout <= 0 ? -1 : now + (int64)timeout * 1000;
+    int64  nextStart = now;
+    size_t next      = 0;
+    int    active    = 0;
+    int    lastError = 0;
+    Socket* winner   = 0;
+
+    try
+    {
+        while (winner == 0)
+        {
+            now = tickcount_us();
+
+            // start the next attempt when its turn came or nothing is in flight
+            if (next < addresses.size() && (now >= nextStart || active == 0))
+            {
+                Attempt attempt = { addresses[next++], -1, 0, false };
+
+                m_attempts.push_back(attempt);
+                started.push_back(now);
+                sockets.push_back(0);
+
+                size_t index = sockets.size() - 1;
+                nextStart = now + (int64)m_stagger * 1000;
+
+                try
+                {
+                    sockets[index] = new Socket((Socket::AddressFamily)attempt.address.family());
+                    sockets[index]->setBlocking(false);
+
+                    if (sockets[index]->beginConnect(attempt.address, port))
+                    {
+                        winner = sockets[index];
+                        sockets[index] = 0;
+
+                        m_attempts[index].latency = tickcount_us() - now;
+                        m_attempts[index].winner  = true;
+                    }
+                    else active++;
+                }
+                catch (SocketException&)
+                {
+                    lastError = Socket::error();
+
+                    m_attempts[index].latency = tickcount_us() - now;
+                    m_attempts[index].error   = lastError;
+
+                    delete sockets[index];
+                    sockets[index] = 0;
+                    nextStart = now;
+                }
+
+                continue;
+            }
+
+            if (active == 0)
+            {
+                set_socket_error(lastError);
+                throw SocketException("All connect attempts failed");
+            }
+
+            if (deadline >= 0 && now >= deadline) throw TimeoutException("Timeout while connect");
+
+            int wait = deadline < 0 ? -1 : (int)((deadline - now + 999) / 1000);
+
+            if (next < addresses.size())
+            {
+                int delay = (int)((nextStart - now + 999) / 1000);
+                if (wait < 0 || delay < wait) wait = delay;
+            }
+
+            std::vector<pollfd> fds;
+            std::vector<size_t> indexes;
+
+            for (size_t n = 0; n < sockets.size(); ++n)
+            {
+                if (sockets[n] == 0) continue;
+
+                pollfd pfd = { sockets[n]->handle(), POLLOUT, 0 };
+                fds.push_back(pfd);
+                indexes.push_back(n);
+            }
+
+            int num = connector_poll(&fds[0], fds.size(), wait);
+
+            if (num < 0)
+            {
+                if (Socket::error() == EINTR) continue;
+                throw SocketException();
+            }
+
+            now = tickcount_us();
+
+            for (size_t k = 0; k < fds.size() && num > 0 && winner == 0; ++k)
+            {
+                if (fds[k].revents == 0) continue;
+
+                size_t index = indexes[k];
+                Socket* socket = sockets[index];
+
+                sockets[index] = 0;
+                active--;
+
+                m_attempts[index].latency = now - started[index];
+
+                try
+                {
+                    socket->endConnect();
+
+                    winner = socket;
+                    m_attempts[index].winner = true;
+                }
+                catch (SocketException&)
+                {
+                    lastError = Socket::error();
+                    m_attempts[index].error = lastError;
+
+                    delete socket;
+                    nextStart = now;
+                }
+            }
+        }
+    }
+    catch (...)
+    {
+        for (size_t n = 0; n < sockets.size(); ++n) delete sockets[n];
+        throw;
+    }
+
+    // the losing attempts are abandoned
+    for (size_t n = 0; n < sockets.size(); ++n) delete sockets[n];
+
+    try
+    {
+        winner->setBlocking(true);
+    }
+    catch (...)
+    {
+        delete winner;
+        throw;
+    }
+
+    return winner;
+}
+
+Socket* Connector::connect (const string& host, int port, int timeout)
+{
+    // the lookups are charged to the timeout as well
+    int64 deadline = timeout <= 0 ? -1 : tickcount_us() + (int64)timeout * 1000;
+
+    Resolution* resolution = new Resolution();
+    resolution->refs  = 3;
+    resolution->done6 = false;
+    resolution->done4 = false;
+
+    DnsResolver* resolver = DnsResolver::shared();
+
+    resolver->resolve(host, Socket::InterNetworkV6, DnsResolver::ResolveHandler(resolution, &Resolution::onResolved6));
+    resolver->resolve(host, Socket::InterNetwork,   DnsResolver::ResolveHandler(resolution, &Resolution::onResolved4));
+
+    IpAddresses addresses6, addresses4;
+
+    resolution->lock.lock();
+
+    bool inTime = true;
+
+    while (!resolution->done4 && inTime) inTime = resolution->cond.waitUntil(resolution->lock, deadline);
+
+    // IPv6 is preferred but a slow AAAA lookup must not hold up IPv4
+    if (resolution->addresses4.empty())
+    {
+        while (!resolution->done6 && inTime) inTime = resolution->cond.waitUntil(resolution->lock, deadline);
+    }
+    else if (!resolution->done6)
+    {
+        int64 delay = tickcount_us() + (int64)ResolutionDelay * 1000;
+        resolution->cond.waitUntil(resolution->lock, deadline >= 0 && deadline < delay ? deadline : delay);
+    }
+
+    addresses6 = resolution->addresses6;
+    addresses4 = resolution->addresses4;
+
+    resolution->lock.unlock();
+    resolution->release();
+
+    if (addresses6.empty() && addresses4.empty())
+    {
+        if (!inTime) throw TimeoutException("Timeout while resolving host");
+        throw NotFoundException("Host name could not be resolved");
+    }
+
+    IpAddresses addresses;
+
+    for (size_t n = 0; n < addresses6.size() || n < addresses4.size(); ++n)
+    {
+        // literals and hosts entries are answered for both families
+        if (n < addresses6.size() && !contains(addresses, addresses6[n])) addresses.push_back(addresses6[n]);
+        if (n < addresses4.size() && !contains(addresses, addresses4[n])) addresses.push_back(addresses4[n]);
+    }
+
+    if (deadline >= 0)
+    {
+        int64 remain = deadline - tickcount_us();
+        if (remain <= 0) throw TimeoutException("Timeout while connect");
+
+        timeout = (int)((remain + 999) / 1000);
+    }
+
+    return connect(addresses, port, timeout);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void Connector::Resolution::onResolved6 (const string& host, int error, const IpAddresses& addresses)
+{
+    lock.lock();
+    addresses6 = addresses;
+    done6 = true;
+    cond.broadcast();
+    lock.unlock();
+
+    release();
+}
+
+void Connector::Resolution::onResolved4 (const string& host, int error, const IpAddresses& addresses)
+{
+    lock.lock();
+    addresses4 = addresses;
+    done4 = true;
+    cond.broadcast();
+    lock.unlock();
+
+    release();
+}
+
+void Connector::Resolution::release ()
+{
+    lock.lock();
+    int count = --refs;
+    lock.unlock();
+
+    if (count == 0) delete this;
+}
+
+END_NAMESPACE_LIB
@@ -0,0 +1,72 @@
+#ifndef LIB_CONNECTOR_H
+#define LIB_CONNECTOR_H
+
+#include "dns.h"
+
+BEGIN_NAMESPACE_LIB
+
+//////////////////////////////////////////////////////////////////////////
+// Connects to the first reachable address of a host in the manner of happy
+// eyeballs (RFC 8305): non-blocking connects are started one stagger delay
+// apart, or at once when the previous attempt failed, and run in parallel.
+// The first completed handshake wins and the other attempts are closed, so a
+// black-holed address only costs the stagger delay instead of the timeout.
+// The returned socket is blocking and owned by the caller.
+class Connector
+{
+public:
+    // ResolutionDelay is how long IPv6 answers are awaited after the IPv4 ones, in milliseconds
+    enum { DefaultStagger = 250, ResolutionDelay = 50 };
+
+    struct Attempt
+    {
+        IpAddress   address;
+        int64       latency;    // microseconds from the start of the attempt, -1 if unfinished
+        int         error;      // socket error, 0 for the winner and unfinished attempts
+        bool        winner;
+    };
+
+public:
+    // stagger is the delay between attempts in milliseconds
+    Connector (int stagger = DefaultStagger);
+
+    // throws TimeoutException when nothing connected in time and SocketException when all attempts failed,
+    // a timeout <= 0 waits as long as the connects take, like Socket::connect
+    Socket* connect     (const IpAddresses& addresses, int port, int timeout = 15000);
+
+    // resolves both address families, IPv6 and IPv4 addresses are tried alternately.
+    // the lookups count against the timeout
+    Socket* connect     (const string& host, int port, int timeout = 15000);
+
+    // the attempts of the last connect in the order they were started
+    const std::vector<Attempt>& attempts ()   { return m_attempts; }
+
+    int     stagger     ()              { return m_stagger;  }
+
+    void    setStagger  (int value)     { m_stagger = value; }
+
+protected:
+    // shared by the caller and both lookups, the caller may stop waiting for IPv6
+    struct Resolution
+    {
+        Mutex       lock;
+        Condition   cond;
+        int         refs;
+        bool        done6;
+        bool        done4;
+        IpAddresses addresses6;
+        IpAddresses addresses4;
+
+        void onResolved6 (const string& host, int error, const IpAddresses& addresses);
+        void onResolved4 (const string& host, int error, const IpAddresses& addresses);
+        void release     ();
+    };
+
+protected:
+    int                     m_stagger;
+    std::vector<Attempt>    m_attempts;
+};
+
+END_NAMESPACE_LIB
+
+#endif //LIB_CONNECTOR_H
@@ -36,8 +36,8 @@ private: \
       R (*entry)(PARAM); \
       virtual R invoke (PARAM) { return (*entry)(ARGS); } \
     }; \
-    enum { HolderSize = 28 }; \
-    int type; char holder[HolderSize]; \
+    enum { HolderSize = 4 * sizeof(void*) }; \
+    int type; union { char holder[HolderSize]; void* aligner; }; \
 }
 
 #define TMPL_DECL_0    template <class R> struct delegate<R, void>
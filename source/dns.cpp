@@ -0,0 +1,524 @@
+#include "dns.h"
+#include "files.h"
+#include "utils.h"
+
+#include <ctype.h>
+
+BEGIN_NAMESPACE_LIB
+
+enum { DnsTypeA = 1, DnsTypeAAAA = 28, DnsClassIN = 1, DnsMaxPacket = 4096, TimerPeriod = 50 };
+
+static string cache_key (const string& host, int family)
+{
+    string key = toLower(host);
+    key.push_back(family == AF_INET6 ? '6' : '4');
+    return key;
+}
+
+// whitespace separated fields of a configuration line, comments removed
+static strings fields_of (const string& line)
+{
+    strings parts = split(line.substr(0, line.find('#')));
+    strings fields;
+
+    for (size_t n = 0; n < parts.size(); ++n)
+    {
+        if (!parts[n].empty()) fields.push_back(parts[n]);
+    }
+
+    return fields;
+}
+
+// skip a possibly compressed domain name
+static void skip_name (Buffer& buffer)
+{
+    for (;;)
+    {
+        byte len = buffer.readByte();
+
+        if (len == 0) return;
+        if ((len & 0xC0) == 0xC0) { buffer.forward(1); return; }
+
+        buffer.forward(len);
+    }
+}
+
+// the question section of a query for the host name
+static void append_question (Buffer& buffer, const string& host, int type)
+{
+    strings labels = split(host, ".");
+
+    for (size_t n = 0; n < labels.size(); ++n)
+    {
+        int len = min((int)labels[n].size(), 63);
+
+        buffer.appendByte(len);
+        buffer.appendBytes(labels[n].c_str(), len);
+    }
+
+    buffer.appendByte(0);
+    buffer.appendUInt16(type);
+    buffer.appendUInt16(DnsClassIN);
+}
+
+// compares and skips the echoed question, names are case insensitive
+static bool match_question (Buffer& buffer, const Buffer& question)
+{
+    if (buffer.remaining() < question.length()) return false;
+
+    const char* echoed = buffer.current();
+
+    for (int n = 0; n < question.length(); ++n)
+    {
+        if (tolower((byte)echoed[n]) != tolower((byte)question.begin()[n])) return false;
+    }
+
+    buffer.forward(question.length());
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+DnsResolver::DnsResolver ()
+{
+    IpAddress server = IpAddress::Loopback;
+
+    try
+    {
+        strings lines = File::readAllLines("/etc/resolv.conf");
+
+        for (size_t n = 0; n < lines.size(); ++n)
+        {
+            strings fields = fields_of(lines[n]);
+
+            if (fields.size() >= 2 && fields[0] == "nameserver" && IpAddress::tryParse(fields[1].c_str(), &server)) break;
+        }
+    }
+    catch (...)
+    {
+        log_warn("DnsResolver: /etc/resolv.conf could not be read, using %s\n", server.toString().c_str());
+    }
+
+    init(SocketAddress(server, DefaultPort));
+}
+
+DnsResolver::DnsResolver (const IpAddress& server, int port)
+{
+    init(SocketAddress(server, port));
+}
+
+void DnsResolver::init (const SocketAddress& server)
+{
+    m_server    = server;
+    m_timer     = Reactor::InvalidTimer;
+    m_timeout   = DefaultTimeout;
+    m_retries   = DefaultRetries;
+    m_seed      = (uint)tickcount_us() | 1;
+    m_nextSweep = 0;
+    m_hits      = 0;
+    m_misses    = 0;
+    m_coalesced = 0;
+
+    loadHosts();
+
+    IpAddress any = server.family() == AF_INET6 ? IpAddress::IPv6Any : IpAddress::Any;
+    m_socket = new UdpSocket(any, 0);
+
+    m_reactor.add(m_socket, Socket::SelectRead, Reactor::SocketHandler(this, &DnsResolver::onReceive));
+
+    m_thread.setOptions(ThreadOptions("dns-resolver"));
+    m_thread.start(this, &DnsResolver::threadEntry);
+}
+
+DnsResolver::~DnsResolver ()
+{
+    m_reactor.stop();
+    m_thread.join();
+
+    m_reactor.remove(m_socket);
+    delete m_socket;
+
+    // waiters of unfinished queries are dropped with them
+    for (QueryMap::iterator it = m_pending.begin(); it != m_pending.end(); ++it) delete it->second;
+}
+
+DnsResolver* DnsResolver::shared ()
+{
+    static DnsResolver resolver;
+    return &resolver;
+}
+
+void DnsResolver::loadHosts ()
+{
+    try
+    {
+        strings lines = File::readAllLines("/etc/hosts");
+
+        for (size_t n = 0; n < lines.size(); ++n)
+        {
+            strings fields = fields_of(lines[n]);
+
+            IpAddress address;
+            if (fields.size() < 2 || !IpAddress::tryParse(fields[0].c_str(), &address)) continue;
+
+            for (size_t k = 1; k < fields.size(); ++k)
+            {
+                m_hosts.insert(std::make_pair(toLower(fields[k]), address));
+            }
+        }
+    }
+    catch (...)
+    {
+    }
+}
+
+bool DnsResolver::lookupStatic (const string& host, int family, IpAddresses* result)
+{
+    IpAddress literal;
+
+    if (IpAddress::tryParse(host.c_str(), &literal))
+    {
+        result->push_back(literal);
+        return true;
+    }
+
+    typedef std::multimap<string, IpAddress>::iterator iterator;
+    std::pair<iterator, iterator> range = m_hosts.equal_range(toLower(host));
+
+    for (iterator it = range.first; it != range.second; ++it)
+    {
+        if (it->second.family() == family) result->push_back(it->second);
+    }
+
+    if (result->empty() && equalNoCase(host, "localhost"))
+    {
+        result->push_back(family == AF_INET6 ? IpAddress::IPv6Loopback : IpAddress::Loopback);
+    }
+
+    return !result->empty();
+}
+
+void DnsResolver::resolve (const string& host, int family, ResolveHandler handler)
+{
+    IpAddresses addresses;
+
+    if (lookupStatic(host, family, &addresses))
+    {
+        handler.invoke(host, Error::None, addresses);
+        return;
+    }
+
+    string key = cache_key(host, family);
+
+    // expired entries are left to the sweeps of complete()
+    SharedLock shared(m_cacheLock);
+
+    CacheMap::iterator cached = m_cache.find(key);
+
+    if (cached != m_cache.end() && cached->second.expires > tickcount_us())
+    {
+        CacheEntry entry = cached->second;
+        shared.unlock();
+
+        atomic_add(&m_hits, (int64)1);
+        handler.invoke(host, entry.error, entry.addresses);
+        return;
+    }
+
+    shared.unlock();
+
+    AutoLock lock(m_lock);
+
+    m_misses++;
+
+    QueryMap::iterator pending = m_pending.find(key);
+
+    if (pending != m_pending.end())
+    {
+        pending->second->waiters.push_back(handler);
+        m_coalesced++;
+        return;
+    }
+
+    Query* query = new Query();
+    query->key      = key;
+    query->host     = host;
+    query->family   = family;
+    query->id       = 0;
+    query->attempts = 0;
+    query->deadline = 0;
+    query->waiters.push_back(handler);
+
+    m_pending[key] = query;
+
+    lock.unlock();
+
+    m_reactor.queueTask(new AsyncTask<Query*>(this, &DnsResolver::sendQuery, query));
+}
+
+IpAddresses DnsResolver::resolve (const string& host, int family)
+{
+    // the resolver always answers within its own timeout, so the wait is unbounded
+    Waiter waiter;
+    resolve(host, family, ResolveHandler(&waiter, &Waiter::onResolved));
+
+    waiter.done.wait();
+
+    if (waiter.error == Error::Timeout) throw TimeoutException("Timeout while resolve host name");
+    if (waiter.error != Error::None) throw NotFoundException("Host name could not be resolved");
+
+    return waiter.addresses;
+}
+
+void DnsResolver::Waiter::onResolved (const string& host, int code, const IpAddresses& result)
+{
+    error = code;
+    addresses = result;
+    done.notify();
+}
+
+void DnsResolver::clearCache ()
+{
+    ScopedLock<SharedMutex> lock(m_cacheLock);
+    m_cache.clear();
+}
+
+void DnsResolver::pruneCache (int64 now)
+{
+    // a sweep a minute, or whenever the cache is full
+    if (now < m_nextSweep && (int)m_cache.size() < MaxCacheEntries) return;
+
+    m_nextSweep = now + (int64)60 * 1000000;
+
+    for (CacheMap::iterator it = m_cache.begin(); it != m_cache.end(); )
+    {
+        if (it->second.expires <= now) m_cache.erase(it++);
+        else ++it;
+    }
+
+    // still full of live names, make room for the new answer
+    while ((int)m_cache.size() >= MaxCacheEntries)
+    {
+        CacheMap::iterator first = m_cache.begin();
+
+        for (CacheMap::iterator it = m_cache.begin(); it != m_cache.end(); ++it)
+        {
+            if (it->second.expires < first->second.expires) first = it;
+        }
+
+        m_cache.erase(first);
+    }
+}
+
+ushort DnsResolver::nextId ()
+{
+    // xorshift, query ids should not be predictable
+    for (;;)
+    {
+        m_seed ^= m_seed << 13;
+        m_seed ^= m_seed >> 17;
+        m_seed ^= m_seed << 5;
+
+        ushort id = (ushort)m_seed;
+        if (id && m_inflight.find(id) == m_inflight.end()) return id;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// below runs on the resolver thread
+
+void DnsResolver::threadEntry ()
+{
+    m_reactor.run();
+}
+
+void DnsResolver::sendQuery (Query* query)
+{
+    if (query->id == 0)
+    {
+        query->id = nextId();
+        m_inflight[query->id] = query;
+    }
+
+    Buffer packet(512, Endian::Big);
+
+    packet.appendUInt16(query->id);
+    packet.appendUInt16(0x0100);    // recursion desired
+    packet.appendUInt16(1);         // questions
+    packet.appendUInt16(0);
+    packet.appendUInt16(0);
+    packet.appendUInt16(0);
+
+    append_question(packet, query->host, query->family == AF_INET6 ? DnsTypeAAAA : DnsTypeA);
+
+    query->attempts++;
+    query->deadline = tickcount_us() + (int64)m_timeout * 1000 / (m_retries + 1);
+
+    if (m_timer == Reactor::InvalidTimer)
+    {
+        m_timer = m_reactor.addTimer(TimerPeriod, Reactor::TimerHandler(this, &DnsResolver::onTimer));
+    }
+
+    try
+    {
+        m_socket->sendTo(packet.begin(), 0, packet.length(), m_server.ipAddress(), m_server.port());
+    }
+    catch (...)
+    {
+        // treated as a lost datagram, the timer retries
+    }
+}
+
+void DnsResolver::onReceive (Socket* socket, int events)
+{
+    char data[DnsMaxPacket];
+
+    for (;;)
+    {
+        IpAddress host; int port = 0;
+
+        int num = socket->receiveFrom(data, 0, sizeof(data), &host, &port);
+        if (num < 0) break;
+
+        // ignore datagrams not coming from the name server
+        if (port != m_server.port() || host.toV4() != m_server.ipAddress().toV4()) continue;
+
+        Query* query = 0;
+        IpAddresses addresses;
+        int error = Error::None, ttl = 0;
+
+        if (parseResponse(data, num, &query, &addresses, &error, &ttl))
+        {
+            complete(query, error, addresses, ttl);
+        }
+    }
+}
+
+bool DnsResolver::parseResponse (const char* data, int size, Query** query, IpAddresses* result, int* error, int* ttl)
+{
+    try
+    {
+        Buffer packet(data, size, Endian::Big);
+
+        ushort id      = packet.readUInt16();
+        ushort flags   = packet.readUInt16();
+        ushort qdcount = packet.readUInt16();
+        ushort ancount = packet.readUInt16();
+
+        packet.forward(4); // authority and additional counts
+
+        InflightMap::iterator it = m_inflight.find(id);
+        if (it == m_inflight.end() || (flags & 0x8000) == 0 || qdcount != 1) return false;
+
+        int wanted = it->second->family == AF_INET6 ? DnsTypeAAAA : DnsTypeA;
+        int rcode  = flags & 0x0F;
+
+        // a stray reply with a guessed or reused id must not complete the query
+        Buffer question(256, Endian::Big);
+        append_question(question, it->second->host, wanted);
+
+        if (!match_question(packet, question)) return false;
+
+        *query = it->second;
+
+        int minTtl = MaxTtl;
+
+        for (int n = 0; n < ancount; ++n)
+        {
+            skip_name(packet);
+
+            ushort type   = packet.readUInt16();
+            ushort klass  = packet.readUInt16();
+            uint   life   = packet.readUInt32();
+            ushort length = packet.readUInt16();
+
+            // CNAME records are skipped, servers append the records of the target name
+            if (type == wanted && klass == DnsClassIN && length == (wanted == DnsTypeA ? 4 : 16))
+            {
+                result->push_back(IpAddress((const byte*)packet.current(), length));
+                if ((int)life < minTtl) minTtl = life;
+            }
+
+            packet.forward(length);
+        }
+
+        // the records which did fit are whole, but a truncated reply without them proves nothing
+        bool truncated = (flags & 0x0200) != 0;
+
+        if (rcode == 0 && !result->empty()) { *error = Error::None; *ttl = minTtl; }
+        else if (truncated)                 { *error = Error::Protocol; *ttl = 0; } // not cached, the next lookup asks again
+        else if (rcode == 0 || rcode == 3)  { *error = Error::NotFound; *ttl = NegativeTtl; } // no data or NXDOMAIN
+        else { *error = Error::Protocol; *ttl = 0; }
+
+        return true;
+    }
+    catch (...)
+    {
+        // malformed or truncated packet
+        return false;
+    }
+}
+
+void DnsResolver::onTimer ()
+{
+    int64 now = tickcount_us();
+    std::vector<Query*> expired;
+
+    m_timer = Reactor::InvalidTimer;
+
+    for (InflightMap::iterator it = m_inflight.begin(); it != m_inflight.end(); ++it)
+    {
+        if (it->second->deadline <= now) expired.push_back(it->second);
+    }
+
+    for (size_t n = 0; n < expired.size(); ++n)
+    {
+        Query* query = expired[n];
+
+        if (query->attempts > m_retries) complete(query, Error::Timeout, IpAddresses(), 0);
+        else sendQuery(query);
+    }
+
+    if (!m_inflight.empty() && m_timer == Reactor::InvalidTimer)
+    {
+        m_timer = m_reactor.addTimer(TimerPeriod, Reactor::TimerHandler(this, &DnsResolver::onTimer));
+    }
+}
+
+void DnsResolver::complete (Query* query, int error, const IpAddresses& addresses, int ttl)
+{
+    m_inflight.erase(query->id);
+
+    if (ttl > 0)
+    {
+        ScopedLock<SharedMutex> lock(m_cacheLock);
+
+        int64 now = tickcount_us();
+        pruneCache(now);
+
+        CacheEntry& entry = m_cache[query->key];
+        entry.error     = error;
+        entry.addresses = addresses;
+        entry.expires   = now + (int64)ttl * 1000000;
+    }
+
+    // a lookup racing with the answer at worst queries again
+    m_lock.lock();
+    m_pending.erase(query->key);
+    m_lock.unlock();
+
+    for (size_t n = 0; n < query->waiters.size(); ++n)
+    {
+        try
+        {
+            query->waiters[n].invoke(query->host, error, addresses);
+        }
+        catch (...)
+        {
+            logmsg("Exception was thrown in dns resolve handler\n");
+        }
+    }
+
+    delete query;
+}
+
+END_NAMESPACE_LIB
@@ -0,0 +1,140 @@
+#ifndef LIB_DNS_H
+#define LIB_DNS_H
+
+#include "reactor.h"
+
+#include <map>
+
+BEGIN_NAMESPACE_LIB
+
+typedef std::vector<IpAddress> IpAddresses;
+
+//////////////////////////////////////////////////////////////////////////
+// Asynchronous resolver speaking the DNS protocol over UDP to a single name
+// server, answers are cached for their TTL, up to MaxCacheEntries names, and
+// concurrent lookups of the same name share one query. IP literals, localhost
+// and /etc/hosts entries are answered without a query. The handler receives an Error code, it is called
+// on the calling thread for immediate answers and on the resolver thread else.
+class DnsResolver
+{
+public:
+    typedef delegate3<void, const string&, int, const IpAddresses&> ResolveHandler;
+
+    enum { DefaultPort = 53, DefaultTimeout = 5000, DefaultRetries = 2, NegativeTtl = 5, MaxTtl = 86400, MaxCacheEntries = 4096 };
+
+public:
+    // uses the first name server of /etc/resolv.conf
+    DnsResolver ();
+
+    DnsResolver (const IpAddress& server, int port = DefaultPort);
+
+    virtual ~DnsResolver ();
+
+    void        resolve     (const string& host, int family, ResolveHandler handler);
+
+    // blocks until resolved, throws NotFoundException or TimeoutException on failure
+    IpAddresses resolve     (const string& host, int family = Socket::InterNetwork);
+
+    void        clearCache  ();
+
+    // the total time of a query including retries in milliseconds
+    int         timeout     ()              { return m_timeout; }
+
+    void        setTimeout  (int value)     { m_timeout = value; }
+
+    int         retries     ()              { return m_retries; }
+
+    void        setRetries  (int value)     { m_retries = value; }
+
+    int64       cacheHits   ()              { return m_hits;      }
+
+    int64       cacheMisses ()              { return m_misses;    }
+
+    int64       coalesced   ()              { return m_coalesced; }
+
+    // the process wide resolver used by NetworkStream
+    static DnsResolver* shared ();
+
+protected:
+    struct Query
+    {
+        string                      key;
+        string                      host;
+        int                         family;
+        ushort                      id;
+        int                         attempts;
+        int64                       deadline;   // of the current attempt
+        std::vector<ResolveHandler> waiters;
+    };
+
+    struct CacheEntry
+    {
+        int                         error;
+        IpAddresses                 addresses;
+        int64                       expires;
+    };
+
+    struct Waiter
+    {
+        Event                       done;
+        int                         error;
+        IpAddresses                 addresses;
+
+        void onResolved (const string& host, int error, const IpAddresses& addresses);
+    };
+
+    typedef std::map<string, CacheEntry> CacheMap;
+    typedef std::map<string, Query*>     QueryMap;
+    typedef std::map<ushort, Query*>     InflightMap;
+
+    void    init            (const SocketAddress& server);
+
+    void    loadHosts       ();
+
+    bool    lookupStatic    (const string& host, int family, IpAddresses* result);
+
+    void    threadEntry     ();
+
+    void    sendQuery       (Query* query);
+
+    void    onReceive       (Socket* socket, int events);
+
+    void    onTimer         ();
+
+    bool    parseResponse   (const char* data, int size, Query** query, IpAddresses* result, int* error, int* ttl);
+
+    void    complete        (Query* query, int error, const IpAddresses& addresses, int ttl);
+
+    // drops the expired entries, and the ones expiring first beyond the size limit
+    void    pruneCache      (int64 now);
+
+    ushort  nextId          ();
+
+protected:
+    SocketAddress           m_server;
+    UdpSocket*              m_socket;
+    Reactor                 m_reactor;
+    Thread                  m_thread;
+
+    SharedMutex             m_cacheLock;    // lookups share it, answers write
+    CacheMap                m_cache;
+    int64                   m_nextSweep;
+
+    Mutex                   m_lock;
+    QueryMap                m_pending;
+    InflightMap             m_inflight;     // owned by the resolver thread
+    std::multimap<string, IpAddress> m_hosts;
+
+    int                     m_timer;        // armed while queries are in flight
+    int                     m_timeout;
+    int                     m_retries;
+    uint                    m_seed;
+
+    volatile int64          m_hits;
+    int64                   m_misses;
+    int64                   m_coalesced;
+};
+
+END_NAMESPACE_LIB
+
+#endif //LIB_DNS_H
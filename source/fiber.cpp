@@ -0,0 +1,555 @@
+#include "fiber.h"
+#include "connector.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <unistd.h>
+#include <sys/mman.h>
+
+BEGIN_NAMESPACE_LIB
+
+// the fiber running on this thread
+static __thread Fiber* t_fiber = 0;
+
+Fiber::Fiber (FiberScheduler* scheduler, Task* task, int stackSize)
+  : m_scheduler(scheduler), m_task(task), m_stack(0), m_done(false), m_socket(0), m_timer(Reactor::InvalidTimer), m_timedOut(false)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    m_stackSize = (int)((stackSize + page - 1) / page * page);
+
+    void* base = mmap(0, m_stackSize + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (base == MAP_FAILED) throw std::bad_alloc();
+
+    // an overflow faults on the guard page instead of corrupting the neighbour
+    mprotect(base, page, PROT_NONE);
+    m_stack = (char*)base + page;
+
+    getcontext(&m_context);
+    m_context.uc_stack.ss_sp   = m_stack;
+    m_context.uc_stack.ss_size = m_stackSize;
+    m_context.uc_link          = 0;
+
+    makecontext(&m_context, &FiberScheduler::entry, 0);
+}
+
+Fiber::~Fiber ()
+{
+    long page = sysconf(_SC_PAGESIZE);
+    munmap(m_stack - page, m_stackSize + page);
+
+    delete m_task;
+}
+
+void Fiber::onTimeout ()
+{
+    m_timer    = Reactor::InvalidTimer;
+    m_timedOut = true;
+
+    if (m_socket)
+    {
+        m_scheduler->m_waiting.erase(m_socket);
+        m_socket = 0;
+    }
+
+    m_scheduler->resume(this);
+}
+
+//////////////////////////////////////////////////////////////////////////
+FiberScheduler::FiberScheduler (Reactor* reactor, int stackSize) : m_reactor(reactor), m_stackSize(stackSize)
+{
+}
+
+FiberScheduler::~FiberScheduler ()
+{
+    for (std::map<Socket*, Fiber*>::iterator it = m_waiting.begin(); it != m_waiting.end(); ++it)
+    {
+        if (m_reactor->contains(it->first)) m_reactor->remove(it->first);
+    }
+
+    for (std::set<Fiber*>::iterator it = m_fibers.begin(); it != m_fibers.end(); ++it)
+    {
+        if ((*it)->m_timer != Reactor::InvalidTimer) m_reactor->cancelTimer((*it)->m_timer);
+        delete *it;
+    }
+}
+
+void FiberScheduler::spawn (Task* task)
+{
+    Fiber* fiber = new Fiber(this, task, m_stackSize);
+
+    m_reactor->queueTask(new AsyncTask<Fiber*>(this, &FiberScheduler::start, fiber));
+}
+
+void FiberScheduler::wake (Fiber* fiber)
+{
+    m_reactor->queueTask(new AsyncTask<Fiber*>(this, &FiberScheduler::resume, fiber));
+}
+
+void FiberScheduler::release (Socket* socket)
+{
+    m_waiting.erase(socket);
+
+    if (m_reactor->contains(socket)) m_reactor->remove(socket);
+}
+
+Fiber* FiberScheduler::current ()
+{
+    return t_fiber;
+}
+
+bool FiberScheduler::waitFor (Socket* socket, int events, int timeout)
+{
+    Fiber* fiber = running("FiberScheduler::waitFor");
+    FiberScheduler* self = fiber->m_scheduler;
+
+    if (timeout == 0) return socket->poll(0, (Socket::SelectMode)events);
+
+    // registering again reports the current readiness, so no edge is missed
+    if (self->m_reactor->contains(socket)) self->m_reactor->modify(socket, events);
+    else self->m_reactor->add(socket, events, Reactor::SocketHandler(self, &FiberScheduler::onReady));
+
+    fiber->m_socket   = socket;
+    fiber->m_timedOut = false;
+    self->m_waiting[socket] = fiber;
+
+    if (timeout > 0) fiber->m_timer = self->m_reactor->addTimer(timeout, Reactor::TimerHandler(fiber, &Fiber::onTimeout));
+
+    self->switchOut(fiber);
+
+    return !fiber->m_timedOut;
+}
+
+void FiberScheduler::sleep (int milliseconds)
+{
+    Fiber* fiber = running("FiberScheduler::sleep");
+
+    if (milliseconds <= 0)
+    {
+        yield();
+        return;
+    }
+
+    fiber->m_timer = fiber->m_scheduler->m_reactor->addTimer(milliseconds, Reactor::TimerHandler(fiber, &Fiber::onTimeout));
+    fiber->m_scheduler->switchOut(fiber);
+}
+
+void FiberScheduler::yield ()
+{
+    Fiber* fiber = running("FiberScheduler::yield");
+
+    fiber->m_scheduler->wake(fiber);
+    fiber->m_scheduler->switchOut(fiber);
+}
+
+void FiberScheduler::suspend ()
+{
+    Fiber* fiber = running("FiberScheduler::suspend");
+
+    fiber->m_scheduler->switchOut(fiber);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void FiberScheduler::entry ()
+{
+    Fiber* fiber = t_fiber;
+
+    try
+    {
+        fiber->m_task->run();
+    }
+    catch (...)
+    {
+        logmsg("Exception was thrown in fiber\n");
+    }
+
+    // freed by resume once back on the loop
+    fiber->m_done = true;
+    fiber->m_scheduler->switchOut(fiber);
+}
+
+Fiber* FiberScheduler::running (const char* operation)
+{
+    if (t_fiber == 0) throw InvalidOperationException(operation);
+
+    return t_fiber;
+}
+
+void FiberScheduler::start (Fiber* fiber)
+{
+    m_fibers.insert(fiber);
+    resume(fiber);
+}
+
+void FiberScheduler::resume (Fiber* fiber)
+{
+    // fibers only switch to the loop, never to each other
+    if (t_fiber)
+    {
+        wake(fiber);
+        return;
+    }
+
+    t_fiber = fiber;
+    swapcontext(&m_loop, &fiber->m_context);
+    t_fiber = 0;
+
+    if (fiber->m_done)
+    {
+        m_fibers.erase(fiber);
+        delete fiber;
+    }
+}
+
+void FiberScheduler::switchOut (Fiber* fiber)
+{
+    swapcontext(&fiber->m_context, &m_loop);
+}
+
+void FiberScheduler::onReady (Socket* socket, int events)
+{
+    std::map<Socket*, Fiber*>::iterator it = m_waiting.find(socket);
+
+    // reported while nobody waits, the fiber reads or writes until WouldBlock anyway
+    if (it == m_waiting.end()) return;
+
+    Fiber* fiber = it->second;
+    m_waiting.erase(it);
+    fiber->m_socket = 0;
+
+    if (fiber->m_timer != Reactor::InvalidTimer)
+    {
+        m_reactor->cancelTimer(fiber->m_timer);
+        fiber->m_timer = Reactor::InvalidTimer;
+    }
+
+    resume(fiber);
+}
+
+//////////////////////////////////////////////////////////////////////////
+FiberStream::FiberStream (Socket* socket, bool own) : NetworkStream(socket, own), m_scheduler(0)
+{
+    m_socket->setBlocking(false);
+}
+
+FiberStream::FiberStream (const IpAddress& host, int port, int connectTimeout)
+  : NetworkStream(connect(host, port, connectTimeout), true), m_scheduler(FiberScheduler::current()->scheduler())
+{
+}
+
+FiberStream::FiberStream (const string& host, int port, int connectTimeout)
+  : NetworkStream(connect(host, port, connectTimeout), true), m_scheduler(FiberScheduler::current()->scheduler())
+{
+}
+
+FiberStream::~FiberStream ()
+{
+    // the destructor of NetworkStream does not reach the override
+    close();
+}
+
+bool FiberStream::readyRead (int timeout)
+{
+    if (m_socket->poll(0, Socket::SelectRead)) return true;
+    if (timeout == 0) return false;
+
+    if (m_scheduler == 0) m_scheduler = FiberScheduler::running("FiberStream::readyRead")->scheduler();
+
+    return FiberScheduler::waitFor(m_socket, Socket::SelectRead, timeout);
+}
+
+bool FiberStream::readyWrite (int timeout)
+{
+    if (m_socket->poll(0, Socket::SelectWrite)) return true;
+    if (timeout == 0) return false;
+
+    if (m_scheduler == 0) m_scheduler = FiberScheduler::running("FiberStream::readyWrite")->scheduler();
+
+    return FiberScheduler::waitFor(m_socket, Socket::SelectWrite, timeout);
+}
+
+int FiberStream::read (void* data, int offset, int size)
+{
+    if (size <= 0) return 0;
+
+    for (;;)
+    {
+        // errors are thrown by the socket
+        int num = m_socket->receive(data, offset, size);
+        if (num != WouldBlock) return num;
+
+        wait(Socket::SelectRead, m_recvTimeout, "Timeout while read network stream");
+    }
+}
+
+int FiberStream::write (const void* data, int offset, int size)
+{
+    if (size <= 0) return 0;
+
+    for (;;)
+    {
+        int num = m_socket->send(data, offset, size);
+        if (num != WouldBlock) return num;
+
+        wait(Socket::SelectWrite, m_sendTimeout, "Timeout while write network stream");
+    }
+}
+
+int FiberStream::writev (const iovec* vec, int count)
+{
+    if (count <= 0) return 0;
+
+    for (;;)
+    {
+        int num = m_socket->send(vec, count);
+        if (num != WouldBlock) return num;
+
+        wait(Socket::SelectWrite, m_sendTimeout, "Timeout while write network stream");
+    }
+}
+
+void FiberStream::close ()
+{
+    if (m_socket && m_scheduler) m_scheduler->release(m_socket);
+
+    NetworkStream::close();
+}
+
+void FiberStream::wait (int events, int timeout, const char* message)
+{
+    if (m_scheduler == 0) m_scheduler = FiberScheduler::running(message)->scheduler();
+
+    if (!FiberScheduler::waitFor(m_socket, events, timeout)) throw TimeoutException(message);
+}
+
+//////////////////////////////////////////////////////////////////////////
+Socket* FiberStream::connect (const IpAddress& host, int port, int timeout)
+{
+    Fiber* fiber = FiberScheduler::running("FiberStream::connect");
+    Socket* socket = new Socket((Socket::AddressFamily)host.family());
+
+    try
+    {
+        socket->setBlocking(false);
+
+        if (!socket->beginConnect(host, port))
+        {
+            if (!FiberScheduler::waitFor(socket, Socket::SelectWrite, timeout > 0 ? timeout : -1))
+            {
+                throw TimeoutException("Timeout while connect");
+            }
+
+            socket->endConnect();
+        }
+    }
+    catch (...)
+    {
+        fiber->scheduler()->release(socket);
+        delete socket;
+        throw;
+    }
+
+    return socket;
+}
+
+static bool contains (const IpAddresses& addresses, const IpAddress& address)
+{
+    return std::find(addresses.begin(), addresses.end(), address) != addresses.end();
+}
+
+// receives the answers of the resolver for both families and resumes the
+// fiber. Shared with the resolver, which may answer after the fiber gave up
+struct FiberLookup
+{
+    FiberScheduler* scheduler;
+    Fiber*          fiber;
+    FastMutex       lock;
+    int             refs;
+    bool            done6;
+    bool            done4;
+    int             error;
+    IpAddresses     addresses6;
+    IpAddresses     addresses4;
+
+    int             timer;      // the fields below on the loop thread only
+    bool            waiting;
+
+    void onResolved6 (const string& host, int code, const IpAddresses& result)  { onResolved(code, result, addresses6, done6); }
+
+    void onResolved4 (const string& host, int code, const IpAddresses& result)  { onResolved(code, result, addresses4, done4); }
+
+    void onResolved (int code, const IpAddresses& result, IpAddresses& addresses, bool& done)
+    {
+        {
+            ScopedLock<FastMutex> guard(lock);
+            if (code != Error::None) error = code;
+            addresses = result;
+            done = true;
+        }
+
+        // the reference goes over to the task
+        scheduler->reactor()->queueTask(new AsyncTask<void>(this, &FiberLookup::onAnswer));
+    }
+
+    bool answered (const bool& done)
+    {
+        ScopedLock<FastMutex> guard(lock);
+        return done;
+    }
+
+    bool empty (const IpAddresses& addresses)
+    {
+        ScopedLock<FastMutex> guard(lock);
+        return addresses.empty();
+    }
+
+    void onAnswer ()
+    {
+        if (waiting)
+        {
+            waiting = false;
+            scheduler->wake(fiber);
+        }
+
+        release();
+    }
+
+    void onTimeout ()
+    {
+        timer = Reactor::InvalidTimer;
+
+        if (waiting)
+        {
+            waiting = false;
+            scheduler->wake(fiber);
+        }
+    }
+
+    // in the fiber, until the next answer or the deadline, false once it passed
+    bool wait (int64 deadline)
+    {
+        if (deadline >= 0)
+        {
+            int64 left = deadline - tickcount_us();
+            if (left <= 0) return false;
+
+            timer = scheduler->reactor()->addTimer((int)((left + 999) / 1000), Reactor::TimerHandler(this, &FiberLookup::onTimeout));
+        }
+
+        waiting = true;
+        FiberScheduler::suspend();
+
+        if (timer != Reactor::InvalidTimer)
+        {
+            scheduler->reactor()->cancelTimer(timer);
+            timer = Reactor::InvalidTimer;
+        }
+
+        return deadline < 0 || tickcount_us() < deadline;
+    }
+
+    void release ()
+    {
+        lock.lock();
+        int count = --refs;
+        lock.unlock();
+
+        if (count == 0) delete this;
+    }
+};
+
+Socket* FiberStream::connect (const string& host, int port, int timeout)
+{
+    IpAddress literal;
+    if (IpAddress::tryParse(host.c_str(), &literal)) return connect(literal, port, timeout);
+
+    // the lookups are charged to the timeout as well
+    int64 deadline = timeout <= 0 ? -1 : tickcount_us() + (int64)timeout * 1000;
+
+    FiberLookup* lookup = new FiberLookup();
+    lookup->fiber     = FiberScheduler::running("FiberStream::connect");
+    lookup->scheduler = lookup->fiber->scheduler();
+    lookup->refs      = 3;
+    lookup->done6     = false;
+    lookup->done4     = false;
+    lookup->error     = Error::None;
+    lookup->timer     = Reactor::InvalidTimer;
+    lookup->waiting   = false;
+
+    // answered right away or from the resolver thread, either way through the loop
+    DnsResolver* resolver = DnsResolver::shared();
+
+    resolver->resolve(host, Socket::InterNetworkV6, DnsResolver::ResolveHandler(lookup, &FiberLookup::onResolved6));
+    resolver->resolve(host, Socket::InterNetwork,   DnsResolver::ResolveHandler(lookup, &FiberLookup::onResolved4));
+
+    bool inTime = true;
+
+    while (!lookup->answered(lookup->done4) && inTime) inTime = lookup->wait(deadline);
+
+    // IPv6 is preferred but a slow AAAA lookup must not hold up IPv4, as in Connector
+    if (lookup->empty(lookup->addresses4))
+    {
+        while (!lookup->answered(lookup->done6) && inTime) inTime = lookup->wait(deadline);
+    }
+    else
+    {
+        int64 delay = tickcount_us() + (int64)Connector::ResolutionDelay * 1000;
+        if (deadline >= 0 && deadline < delay) delay = deadline;
+
+        while (!lookup->answered(lookup->done6) && lookup->wait(delay));
+    }
+
+    IpAddresses addresses6, addresses4;
+    int error;
+
+    lookup->lock.lock();
+    addresses6 = lookup->addresses6;
+    addresses4 = lookup->addresses4;
+    error      = lookup->error;
+    lookup->lock.unlock();
+    lookup->release();
+
+    if (addresses6.empty() && addresses4.empty())
+    {
+        if (!inTime || error == Error::Timeout) throw TimeoutException("Timeout while resolve host name");
+        throw NotFoundException("Host name could not be resolved");
+    }
+
+    IpAddresses addresses;
+
+    for (size_t n = 0; n < addresses6.size() || n < addresses4.size(); ++n)
+    {
+        // literals and hosts entries are answered for both families
+        if (n < addresses6.size() && !contains(addresses, addresses6[n])) addresses.push_back(addresses6[n]);
+        if (n < addresses4.size() && !contains(addresses, addresses4[n])) addresses.push_back(addresses4[n]);
+    }
+
+    for (size_t n = 0; n < addresses.size(); ++n)
+    {
+        int remain = -1;
+
+        if (deadline >= 0)
+        {
+            int64 left = deadline - tickcount_us();
+            if (left <= 0) throw TimeoutException("Timeout while connect");
+
+            remain = (int)((left + 999) / 1000);
+        }
+
+        try
+        {
+            return connect(addresses[n], port, remain);
+        }
+        catch (SocketException&)
+        {
+            if (n + 1 == addresses.size()) throw;
+        }
+        catch (TimeoutException&)
+        {
+            if (n + 1 == addresses.size()) throw;
+        }
+    }
+
+    throw SocketException("All connect attempts failed");
+}
+
+END_NAMESPACE_LIB
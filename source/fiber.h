@@ -0,0 +1,165 @@
+#ifndef LIB_FIBER_H
+#define LIB_FIBER_H
+
+#include "reactor.h"
+
+#include <ucontext.h>
+#include <set>
+
+BEGIN_NAMESPACE_LIB
+
+class FiberScheduler;
+
+//////////////////////////////////////////////////////////////////////////
+// A stackful coroutine, created by FiberScheduler::spawn and freed when its
+// task has returned.
+class Fiber
+{
+public:
+    FiberScheduler* scheduler   ()  { return m_scheduler; }
+
+protected:
+    Fiber (FiberScheduler* scheduler, Task* task, int stackSize);
+
+    ~Fiber ();
+
+    void    onTimeout   ();
+
+protected:
+    FiberScheduler* m_scheduler;
+    Task*           m_task;
+    ucontext_t      m_context;
+    char*           m_stack;        // mapped with a guard page below
+    int             m_stackSize;
+    bool            m_done;
+
+    Socket*         m_socket;       // waited for, or null
+    int             m_timer;
+    bool            m_timedOut;
+
+    friend class FiberScheduler;
+};
+
+//////////////////////////////////////////////////////////////////////////
+// Runs fibers on the loop thread of a reactor, so blocking style code like
+// StreamReader over a FiberStream serves many connections on one thread. A
+// fiber runs until it waits for a socket, sleeps or yields, then the loop
+// goes on with the other fibers and sockets. The waits below may only be
+// called inside a fiber, spawn from any thread.
+//
+// Fibers still suspended when the scheduler is deleted are dropped without
+// unwinding their stacks, so stop the reactor after the fibers are done.
+class FiberScheduler
+{
+public:
+    enum { DefaultStackSize = 64 * 1024 };
+
+public:
+    FiberScheduler (Reactor* reactor, int stackSize = DefaultStackSize);
+
+    virtual ~FiberScheduler ();
+
+    Reactor* reactor    ()  { return m_reactor; }
+
+    // the number of fibers not finished yet
+    int     count       ()  { return (int)m_fibers.size(); }
+
+    // thread safe, the task runs in a new fiber and is deleted afterwards
+    void    spawn       (Task* task);
+
+    template <class T>
+    void    spawn       (T* object, void (T::*method)())             { spawn(new AsyncTask<void>(object, method)); }
+
+    template <class T, class P>
+    void    spawn       (T* object, void (T::*method)(P), P param)   { spawn(new AsyncTask<P>(object, method, param)); }
+
+    // thread safe, resumes a fiber suspended by suspend()
+    void    wake        (Fiber* fiber);
+
+    // stops waiting for the socket, call before it is closed
+    void    release     (Socket* socket);
+
+
+    // the fiber running on the calling thread, null outside fibers
+    static Fiber* current   ();
+
+    // the same, but throws InvalidOperationException outside fibers
+    static Fiber* running   (const char* operation);
+
+    // returns false on timeout, the socket is registered with the reactor on first use
+    static bool waitFor     (Socket* socket, int events, int timeout = -1);
+
+    static void sleep       (int milliseconds);
+
+    // lets the other fibers and sockets run
+    static void yield       ();
+
+    // until another thread calls wake
+    static void suspend     ();
+
+protected:
+    static void entry       ();
+
+    void    start           (Fiber* fiber);
+
+    void    resume          (Fiber* fiber);
+
+    void    switchOut       (Fiber* fiber);
+
+    void    onReady         (Socket* socket, int events);
+
+protected:
+    Reactor*                    m_reactor;
+    int                         m_stackSize;
+    ucontext_t                  m_loop;     // the loop thread outside the fibers
+    std::set<Fiber*>            m_fibers;
+    std::map<Socket*, Fiber*>   m_waiting;
+
+    friend class Fiber;
+};
+
+//////////////////////////////////////////////////////////////////////////
+// NetworkStream for use inside fibers, reads and writes suspend the fiber
+// instead of blocking the thread. The socket is switched to non-blocking,
+// and the stream has to be closed on the loop thread of its scheduler.
+class FiberStream : public NetworkStream
+{
+public:
+    FiberStream (Socket* socket, bool own = false);
+
+    FiberStream (const IpAddress& host, int port, int connectTimeout = 15000);
+
+    // the host name is resolved with DnsResolver::shared() without blocking the thread
+    FiberStream (const string& host, int port, int connectTimeout = 15000);
+
+    virtual ~FiberStream ();
+
+    virtual bool readyRead  (int timeout);
+
+    virtual bool readyWrite (int timeout);
+
+    virtual int  read       (void* data, int offset, int size);
+
+    virtual int  write      (const void* data, int offset, int size);
+
+    virtual int  writev     (const iovec* vec, int count);
+
+    virtual void close      ();
+
+    // connect without blocking the thread, a timeout <= 0 waits as long as the connect takes
+    static Socket* connect  (const IpAddress& host, int port, int timeout);
+
+    // resolves both address families like Connector and tries the addresses in turn,
+    // IPv6 and IPv4 alternately. The lookups count against the timeout
+    static Socket* connect  (const string& host, int port, int timeout);
+
+protected:
+    void    wait            (int events, int timeout, const char* message);
+
+protected:
+    FiberScheduler* m_scheduler;    // of the fiber which waited first, the socket is registered there
+};
+
+END_NAMESPACE_LIB
+
+#endif //LIB_FIBER_H
@@ -1,4 +1,5 @@
 #include "files.h"
+#include "socket.h"
 
 #include "reader.h"
 #include "writer.h"
@@ -10,8 +11,10 @@
 #include <dirent.h>
 #include <stdio.h>
 #include <sys/stat.h>
+#include <sys/sendfile.h>
 #include <utime.h>
 #include <errno.h>
+#include <limits.h>
 
 #define DS "/"
 
@@ -81,6 +84,73 @@ int FileStream::write (const void* data, int offset, int size)
     return written;
 }
 
+int FileStream::writev (const iovec* vec, int count)
+{
+    if (count <= 0) return 0;
+
+    int written = ::writev(m_handle, vec, min(count, IOV_MAX));
+
+    if (written < 0) throw IOException();
+
+    return written;
+}
+
+int64 FileStream::transferTo (Stream* dest, int64 offset, int64 count)
+{
+    int target  = -1;
+    int timeout = -1;
+
+    if (NetworkStream* ns = dynamic_cast<NetworkStream*>(dest))
+    {
+        target  = ns->socket()->handle();
+        timeout = ns->writeTimeout();
+    }
+    else if (FileStream* fs = dynamic_cast<FileStream*>(dest)) target = fs->handle();
+
+    if (target < 0) return Stream::transferTo(dest, offset, count);
+
+    if (offset >= 0 && lseek64(m_handle, offset, SEEK_SET) < 0) throw IOException();
+
+    const int64 MaxChunk   = 0x7FFFF000; // the most sendfile transfers at once
+    const int64 TimedChunk = 1 << 20;    // a blocking sendfile returns once the chunk is sent, so the timeout is checked this often
+
+    int64 total = 0;
+
+    while (count < 0 || total < count)
+    {
+        int64 limit = timeout >= 0 ? TimedChunk : MaxChunk;
+        int64 size  = (count < 0 || count - total > limit) ? limit : count - total;
+
+        // the send timeout holds as for NetworkStream::write, blocking or not
+        if (timeout >= 0 && !dest->readyWrite(timeout)) throw TimeoutException("Timeout while transfer file stream");
+
+        ssize_t num = ::sendfile(target, m_handle, 0, size);
+
+        if (num < 0)
+        {
+            if (errno == EINTR) continue;
+
+            // non-blocking socket, wait for the send buffer to drain
+            if (errno == EAGAIN)
+            {
+                if (!dest->readyWrite(timeout)) throw TimeoutException("Timeout while transfer file stream");
+                continue;
+            }
+
+            // the descriptors do not support sendfile, copy the rest through user space
+            if ((errno == EINVAL || errno == ENOSYS) && total == 0) return Stream::transferTo(dest, -1, count);
+
+            throw IOException();
+        }
+
+        if (num == 0) break;
+
+        total += num;
+    }
+
+    return total;
+}
+
 int FileStream::seek (int offset, int origin)
 {
     int lowOrigin = SEEK_SET;
@@ -163,17 +233,7 @@ void File::copy(const char* sourcePath, const char* destPath, bool overwrite)
     FileStream input (sourcePath, FileMode::Open, FileAccess::ReadOnly);
     FileStream output(destPath, FileMode::Create, FileAccess::WriteOnly);
 
-    const int BufSize = 32768;
-    byte buffer[BufSize];
-
-    for (;;)
-    {
-        int bytes = input.read(buffer, 0, BufSize);
-        if (bytes < 0) throw IOException();
-        if (bytes == 0) break;
-
-        output.write(buffer, 0, bytes);
-    }
+    input.transferTo(&output);
 }
 
 void File::move(const char* sourcePath, const char* destPath, bool overwrite)
@@ -318,8 +378,20 @@ string File::readContent(Stream* stream)
 
     if (stream->canSeek())
     {
-        int len = stream->length();
-        content.reserve(len > 0 ? len + 64: 0);
+        // read the known length straight into the string, the loop below
+        // only picks up what the file has grown by since
+        int len = stream->length() - stream->position();
+        int total = 0;
+
+        if (len > 0)
+        {
+            content.resize(len);
+
+            while (total < len && (num = stream->read(&content[0], total, len - total)) > 0) total += num;
+
+            content.resize(total);
+            if (total < len) return content;
+        }
     }
 
     while ((num = stream->read(buffer, 0, BUFSIZE)) > 0)
@@ -43,6 +43,7 @@ public:
     // operations
     virtual int  read           (void* data, int offset, int size);
     virtual int  write          (const void* data, int offset, int size);
+    virtual int  writev         (const iovec* vec, int count);
     virtual int  seek           (int offset, int origin);
     virtual int  position       ();
     virtual int  length         ();
@@ -50,6 +51,15 @@ public:
     virtual void flush          ();
     virtual void close          ();
 
+    // uses sendfile when the destination is a file or network stream
+    virtual int64 transferTo    (Stream* dest, int64 offset = -1, int64 count = -1);
+
+    #ifdef WIN32
+    Handle  handle              ()  { return m_handle; }
+    #else
+    int     handle              ()  { return m_handle; }
+    #endif
+
 protected:
     void init (const char* filename, int mode, int access);
 
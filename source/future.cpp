@@ -0,0 +1,231 @@
+#include "future.h"
+
+#include <exception>
+
+BEGIN_NAMESPACE_LIB
+
+FutureStateBase::FutureStateBase () : m_refs(1), m_writers(0), m_ready(false), m_failed(false)
+{
+}
+
+FutureStateBase::~FutureStateBase ()
+{
+    // never satisfied, the continuations can not run anymore
+    for (size_t n = 0; n < m_next.size(); ++n) delete m_next[n].task;
+}
+
+bool FutureStateBase::ready ()
+{
+    AutoLock lock(m_lock);
+    return m_ready;
+}
+
+bool FutureStateBase::failed ()
+{
+    AutoLock lock(m_lock);
+    return m_failed;
+}
+
+bool FutureStateBase::wait (int timeout)
+{
+    AutoLock lock(m_lock);
+    int64 deadline = Condition::deadline(timeout < 0 ? -1 : (int64)timeout * 1000);
+
+    while (!m_ready)
+    {
+        // false return indicates a timeout
+        if (!m_cond.waitUntil(m_lock, deadline)) return m_ready;
+    }
+
+    return true;
+}
+
+void FutureStateBase::throwIfFailed ()
+{
+    AutoLock lock(m_lock);
+
+    if (m_failed) throw m_error;
+}
+
+void FutureStateBase::onReady (ThreadPool* pool, Task* task)
+{
+    Continuation next = { pool, task };
+
+    m_lock.lock();
+
+    if (!m_ready)
+    {
+        m_next.push_back(next);
+        m_lock.unlock();
+        return;
+    }
+
+    m_lock.unlock();
+
+    schedule(next);
+}
+
+void FutureStateBase::lock ()
+{
+    m_lock.lock();
+
+    if (m_ready)
+    {
+        m_lock.unlock();
+        throw InvalidOperationException("The promise was already satisfied");
+    }
+}
+
+void FutureStateBase::complete ()
+{
+    std::vector<Continuation> next;
+
+    m_ready = true;
+    m_next.swap(next);
+    m_cond.broadcast();
+
+    // the continuations may drop the last reference
+    addRef();
+    m_lock.unlock();
+
+    for (size_t n = 0; n < next.size(); ++n) schedule(next[n]);
+
+    release();
+}
+
+void FutureStateBase::fail (const Exception& error)
+{
+    lock();
+
+    m_failed = true;
+    m_error  = error;
+
+    complete();
+}
+
+void FutureStateBase::abandon ()
+{
+    m_lock.lock();
+
+    if (m_ready)
+    {
+        m_lock.unlock();
+        return;
+    }
+
+    m_failed = true;
+    m_error  = Exception(AbortedExceptionType, "The promise was dropped without a value");
+
+    complete();
+}
+
+void FutureStateBase::schedule (const Continuation& next)
+{
+    if (next.pool)
+    {
+        next.pool->queueTask(next.task);
+        return;
+    }
+
+    try
+    {
+        next.task->run();
+    }
+    catch (...)
+    {
+        logmsg("Exception was thrown in future continuation\n");
+    }
+
+    delete next.task;
+}
+
+void future_fail (FutureStateBase* state)
+{
+    try
+    {
+        throw;
+    }
+    catch (Exception& e)
+    {
+        state->fail(e);
+    }
+    catch (std::exception& e)
+    {
+        state->fail(Exception(RuntimeExceptionType, e.what()));
+    }
+    catch (...)
+    {
+        state->fail(Exception(GeneralExceptionType, "Unknown exception"));
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// shared by the continuations of the awaited futures, freed by the last one
+struct FutureJoin
+{
+    FutureJoin (int count) : remaining(count), decided(0) {}
+
+    volatile int    remaining;
+    volatile int    decided;
+    Promise<void>   all;
+    Promise<int>    any;
+
+    void arrive (int index)
+    {
+        if (atomic_exchange(&decided, 1) == 0) any.setValue(index);
+
+        if (atomic_add(&remaining, -1) == 0)
+        {
+            all.setValue();
+            delete this;
+        }
+    }
+};
+
+struct FutureJoinTask : public Task
+{
+    FutureJoinTask (FutureJoin* j, int n) : join(j), index(n) {}
+
+    void run () { join->arrive(index); }
+
+    FutureJoin* join;
+    int         index;
+};
+
+static void arm_join (FutureJoin* join, const std::vector<FutureStateBase*>& states)
+{
+    // the join may be freed by the last registration already
+    for (size_t n = 0; n < states.size(); ++n)
+    {
+        states[n]->onReady(0, new FutureJoinTask(join, (int)n));
+    }
+}
+
+Future<void> when_all (const std::vector<FutureStateBase*>& states)
+{
+    if (states.empty())
+    {
+        Promise<void> done;
+        done.setValue();
+        return done.future();
+    }
+
+    FutureJoin* join = new FutureJoin((int)states.size());
+    Future<void> result = join->all.future();
+
+    arm_join(join, states);
+    return result;
+}
+
+Future<int> when_any (const std::vector<FutureStateBase*>& states)
+{
+    if (states.empty()) throw InvalidArgumentException("No future to wait for");
+
+    FutureJoin* join = new FutureJoin((int)states.size());
+    Future<int> result = join->any.future();
+
+    arm_join(join, states);
+    return result;
+}
+
+END_NAMESPACE_LIB
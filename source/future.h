@@ -0,0 +1,348 @@
+#ifndef LIB_FUTURE_H
+#define LIB_FUTURE_H
+
+#include "task.h"
+#include "atomic.h"
+
+BEGIN_NAMESPACE_LIB
+
+template <class T> class PromiseBase;
+
+//////////////////////////////////////////////////////////////////////////
+// Shared state of a future and its promises. Continuations are tasks queued
+// to their pool, or run on the completing thread without one, once the state
+// is ready. A failure keeps the type and message of the exception.
+class FutureStateBase
+{
+public:
+    FutureStateBase ();
+
+    virtual ~FutureStateBase ();
+
+    void    addRef      ()  { atomic_add(&m_refs, 1); }
+
+    void    release     ()  { if (atomic_add(&m_refs, -1) == 0) delete this; }
+
+    // the promises sharing the state, when the last one goes away unsatisfied
+    // the futures fail with AbortedExceptionType instead of waiting forever
+    void    addWriter   ()  { atomic_add(&m_writers, 1); }
+
+    void    releaseWriter ()    { if (atomic_add(&m_writers, -1) == 0) abandon(); }
+
+    bool    ready       ();
+
+    bool    failed      ();
+
+    // returns false on timeout
+    bool    wait        (int timeout);
+
+    void    throwIfFailed ();
+
+    // the task is deleted after it has run
+    void    onReady     (ThreadPool* pool, Task* task);
+
+    // lock() before setting the value, complete() unlocks
+    void    lock        ();
+
+    void    complete    ();
+
+    void    fail        (const Exception& error);
+
+    // fails the state unless it is ready already
+    void    abandon     ();
+
+protected:
+    struct Continuation
+    {
+        ThreadPool* pool;
+        Task*       task;
+    };
+
+    static void schedule (const Continuation& next);
+
+protected:
+    volatile int                m_refs;
+    volatile int                m_writers;
+    Mutex                       m_lock;
+    Condition                   m_cond;
+    bool                        m_ready;
+    bool                        m_failed;
+    Exception                   m_error;
+    std::vector<Continuation>   m_next;
+};
+
+template <class T>
+class FutureState : public FutureStateBase
+{
+public:
+    T       get         ()                  { return m_value; }
+
+    void    set         (const T& value)    { m_value = value; }
+
+protected:
+    T m_value;
+};
+
+template <>
+class FutureState<void> : public FutureStateBase
+{
+public:
+    void    get         ()  { }
+};
+
+//////////////////////////////////////////////////////////////////////////
+// The result of an asynchronous operation, copies share the same state.
+template <class T>
+class Future
+{
+public:
+    Future () : m_state(0) { }
+
+    Future (const Future& other) : m_state(other.m_state)   { if (m_state) m_state->addRef(); }
+
+    ~Future ()  { if (m_state) m_state->release(); }
+
+    Future& operator = (const Future& other)
+    {
+        if (other.m_state) other.m_state->addRef();
+        if (m_state) m_state->release();
+
+        m_state = other.m_state;
+        return *this;
+    }
+
+    bool    valid       ()  { return m_state != 0; }
+
+    bool    ready       ()  { return m_state && m_state->ready();  }
+
+    bool    failed      ()  { return m_state && m_state->failed(); }
+
+    // returns false on timeout
+    bool    wait        (int timeout = -1)  { return state()->wait(timeout); }
+
+    // throws TimeoutException, the exception of a failed operation is rethrown as Exception
+    T       get         (int timeout = -1)
+    {
+        if (!state()->wait(timeout)) throw TimeoutException("Timeout while Future::get");
+
+        m_state->throwIfFailed();
+        return m_state->get();
+    }
+
+    // the continuation receives this future once it is ready and runs on the pool,
+    // or on the completing thread when pool is null
+    template <class R>
+    Future<R> then      (ThreadPool* pool, delegate<R, Future<T> > continuation);
+
+    template <class R, class C>
+    Future<R> then      (ThreadPool* pool, C* object, R (C::*method)(Future<T>))
+    {
+        return then(pool, delegate<R, Future<T> >(object, method));
+    }
+
+    FutureStateBase* state ()
+    {
+        if (m_state == 0) throw InvalidOperationException("The future has no state");
+        return m_state;
+    }
+
+protected:
+    explicit Future (FutureState<T>* state) : m_state(state) { m_state->addRef(); }
+
+    FutureState<T>* m_state;
+
+    friend class PromiseBase<T>;
+};
+
+//////////////////////////////////////////////////////////////////////////
+// The producing side of a future, copies share the same state. A promise
+// is satisfied once; when the last copy goes away without that, like a
+// task deleted by ThreadPool::stop(false), the futures fail as aborted.
+template <class T>
+class PromiseBase
+{
+public:
+    PromiseBase () : m_state(new FutureState<T>()) { m_state->addWriter(); }
+
+    PromiseBase (const PromiseBase& other) : m_state(other.m_state)   { m_state->addRef(); m_state->addWriter(); }
+
+    ~PromiseBase ()     { m_state->releaseWriter(); m_state->release(); }
+
+    PromiseBase& operator = (const PromiseBase& other)
+    {
+        other.m_state->addRef();
+        other.m_state->addWriter();
+        m_state->releaseWriter();
+        m_state->release();
+
+        m_state = other.m_state;
+        return *this;
+    }
+
+    Future<T> future    ()  { return Future<T>(m_state); }
+
+    void    setException (const Exception& error)   { m_state->fail(error); }
+
+protected:
+    FutureState<T>* m_state;
+};
+
+template <class T>
+class Promise : public PromiseBase<T>
+{
+public:
+    void    setValue    (const T& value)
+    {
+        this->m_state->lock();
+        this->m_state->set(value);
+        this->m_state->complete();
+    }
+};
+
+template <>
+class Promise<void> : public PromiseBase<void>
+{
+public:
+    void    setValue    ()
+    {
+        m_state->lock();
+        m_state->complete();
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////
+// sets the promise from the result of a delegate, void results included
+template <class R>
+struct FutureSetter
+{
+    template <class D>
+    static void call (Promise<R>& promise, D& method)               { promise.setValue(method.invoke()); }
+
+    template <class D, class A>
+    static void call (Promise<R>& promise, D& method, A& arg)       { promise.setValue(method.invoke(arg)); }
+};
+
+template <>
+struct FutureSetter<void>
+{
+    template <class D>
+    static void call (Promise<void>& promise, D& method)            { method.invoke(); promise.setValue(); }
+
+    template <class D, class A>
+    static void call (Promise<void>& promise, D& method, A& arg)    { method.invoke(arg); promise.setValue(); }
+};
+
+// the exception of the running task is stored as the failure of the promise
+void future_fail (FutureStateBase* state);
+
+//////////////////////////////////////////////////////////////////////////
+// Tasks running a delegate and setting its result to a promise
+template <class R, class P = void>
+struct FutureTask : public Task
+{
+    typedef delegate<R,P> method_t;
+    typedef typehold<P>   params_t;
+
+    FutureTask (method_t m, P p) : method(m), params(p) {}
+
+    void run ()
+    {
+        try { FutureSetter<R>::call(promise, method, params.value); }
+        catch (...) { future_fail(promise.future().state()); }
+    }
+
+    method_t    method;
+    params_t    params;
+    Promise<R>  promise;
+};
+
+template <class R>
+struct FutureTask<R, void> : public Task
+{
+    typedef delegate<R,void> method_t;
+
+    FutureTask (method_t m) : method(m) {}
+
+    void run ()
+    {
+        try { FutureSetter<R>::call(promise, method); }
+        catch (...) { future_fail(promise.future().state()); }
+    }
+
+    method_t    method;
+    Promise<R>  promise;
+};
+
+template <class T>
+template <class R>
+Future<R> Future<T>::then (ThreadPool* pool, delegate<R, Future<T> > continuation)
+{
+    FutureTask<R, Future<T> >* task = new FutureTask<R, Future<T> >(continuation, *this);
+    Future<R> result = task->promise.future();
+
+    state()->onReady(pool, task);
+
+    return result;
+}
+
+//////////////////////////////////////////////////////////////////////////
+template <class R>
+Future<R> ThreadPool::queueTask (delegate<R,void> method)
+{
+    FutureTask<R>* task = new FutureTask<R>(method);
+    Future<R> result = task->promise.future();
+
+    queueTask(task);
+    return result;
+}
+
+template <class R, class P>
+Future<R> ThreadPool::queueTask (delegate<R,P> method, P param)
+{
+    FutureTask<R,P>* task = new FutureTask<R,P>(method, param);
+    Future<R> result = task->promise.future();
+
+    queueTask(task);
+    return result;
+}
+
+template <class R, class T>
+Future<R> ThreadPool::queueTask (T* object, R (T::*method)())
+{
+    return queueTask(delegate<R,void>(object, method));
+}
+
+template <class R, class T, class P>
+Future<R> ThreadPool::queueTask (T* object, R (T::*method)(P), P param)
+{
+    return queueTask(delegate<R,P>(object, method), param);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// ready when every future is ready, failed or not
+Future<void> when_all (const std::vector<FutureStateBase*>& states);
+
+// the index of the first ready future
+Future<int>  when_any (const std::vector<FutureStateBase*>& states);
+
+template <class T>
+Future<void> whenAll (std::vector<Future<T> >& futures)
+{
+    std::vector<FutureStateBase*> states;
+    for (size_t n = 0; n < futures.size(); ++n) states.push_back(futures[n].state());
+
+    return when_all(states);
+}
+
+template <class T>
+Future<int> whenAny (std::vector<Future<T> >& futures)
+{
+    std::vector<FutureStateBase*> states;
+    for (size_t n = 0; n < futures.size(); ++n) states.push_back(futures[n].state());
+
+    return when_any(states);
+}
+
+END_NAMESPACE_LIB
+
+#endif //LIB_FUTURE_H
@@ -0,0 +1,486 @@
+#include "io_ring.h"
+#include "atomic.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+// 5.8, older kernels keep no flag and flush the overflow on GETEVENTS only
+#ifndef IORING_SQ_CQ_OVERFLOW
+#define IORING_SQ_CQ_OVERFLOW   (1U << 1)
+#endif
+
+BEGIN_NAMESPACE_LIB
+
+static int io_uring_setup (uint entries, io_uring_params* params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter (int fd, uint submit, uint minComplete, uint flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, submit, minComplete, flags, NULL, 0);
+}
+
+static int io_uring_register (int fd, uint opcode, const void* arg, uint count)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+IoRing::IoRing (int entries, bool kernel)
+  : m_fd(-1), m_pending(0), m_queued(0), m_registered(false), m_sqRing(0), m_cqRing(0), m_sqRingSize(0), m_cqRingSize(0), m_sqes(0), m_sqesSize(0)
+{
+    if (kernel && !setup(entries > 0 ? entries : DefaultEntries))
+    {
+        log_warn("IoRing: io_uring is not available, running operations synchronously\n");
+    }
+}
+
+IoRing::~IoRing ()
+{
+    // operations still in flight are cancelled by the kernel, their handlers are not invoked
+    if (m_sqes) munmap(m_sqes, m_sqesSize);
+    if (m_cqRing && m_cqRing != m_sqRing) munmap(m_cqRing, m_cqRingSize);
+    if (m_sqRing) munmap(m_sqRing, m_sqRingSize);
+
+    if (m_fd >= 0) ::close(m_fd);
+}
+
+void IoRing::read (int fd, void* data, int size, int64 offset, CompletionHandler handler, bool link)
+{
+    queue(IORING_OP_READ, fd, data, size, offset, -1, handler, link);
+}
+
+void IoRing::write (int fd, const void* data, int size, int64 offset, CompletionHandler handler, bool link)
+{
+    queue(IORING_OP_WRITE, fd, (void*)data, size, offset, -1, handler, link);
+}
+
+void IoRing::read (FileStream* file, void* data, int size, int64 offset, CompletionHandler handler, bool link)
+{
+    queue(IORING_OP_READ, file->handle(), data, size, offset, -1, handler, link);
+}
+
+void IoRing::write (FileStream* file, const void* data, int size, int64 offset, CompletionHandler handler, bool link)
+{
+    queue(IORING_OP_WRITE, file->handle(), (void*)data, size, offset, -1, handler, link);
+}
+
+void IoRing::fsync (FileStream* file, CompletionHandler handler, bool link)
+{
+    queue(IORING_OP_FSYNC, file->handle(), 0, 0, 0, -1, handler, link);
+}
+
+void IoRing::send (Socket* socket, const void* data, int size, CompletionHandler handler, bool link)
+{
+    queue(IORING_OP_SEND, socket->handle(), (void*)data, size, 0, -1, handler, link);
+}
+
+void IoRing::receive (Socket* socket, void* data, int size, CompletionHandler handler, bool link)
+{
+    queue(IORING_OP_RECV, socket->handle(), data, size, 0, -1, handler, link);
+}
+
+void IoRing::registerBuffers (const std::vector<iovec>& buffers)
+{
+    if (m_pending) throw InvalidOperationException("IoRing buffers can not change while operations are pending");
+
+    m_buffers = buffers;
+
+    if (m_fd < 0) return;
+
+    if (m_registered) io_uring_register(m_fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+
+    // pinned pages count against RLIMIT_MEMLOCK, the fixed operations fall back to plain ones
+    m_registered = !m_buffers.empty() && io_uring_register(m_fd, IORING_REGISTER_BUFFERS, &m_buffers[0], (uint)m_buffers.size()) == 0;
+
+    if (!m_buffers.empty() && !m_registered) log_warn("IoRing: buffers could not be registered, error %d\n", errno);
+}
+
+void IoRing::readFixed (int fd, int buffer, void* data, int size, int64 offset, CompletionHandler handler, bool link)
+{
+    if (buffer < 0 || buffer >= (int)m_buffers.size()) throw IndexOutOfRangeException("No such registered buffer");
+
+    queue(m_registered ? IORING_OP_READ_FIXED : IORING_OP_READ, fd, data, size, offset, buffer, handler, link);
+}
+
+void IoRing::writeFixed (int fd, int buffer, const void* data, int size, int64 offset, CompletionHandler handler, bool link)
+{
+    if (buffer < 0 || buffer >= (int)m_buffers.size()) throw IndexOutOfRangeException("No such registered buffer");
+
+    queue(m_registered ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, fd, (void*)data, size, offset, buffer, handler, link);
+}
+
+int IoRing::submit ()
+{
+    if (m_fd >= 0)
+    {
+        if (m_queued == 0) return 0;
+
+        int count = enter(m_queued, 0, 0);
+        m_queued -= count;
+
+        return count;
+    }
+
+    // the fallback runs the batch right here, in order
+    std::vector<int> batch;
+    batch.swap(m_submitQueue);
+
+    bool broken = false;
+
+    for (size_t n = 0; n < batch.size(); ++n)
+    {
+        Operation& op = m_slots[batch[n]];
+
+        int result = broken ? -ECANCELED : perform(op);
+
+        // like the kernel, an error or a short transfer cancels the rest of the chain
+        if (op.link) broken = broken || result < 0 || (op.opcode != IORING_OP_FSYNC && result < op.size);
+        else broken = false;
+
+        Completion done = { batch[n], result };
+        m_completed.push_back(done);
+    }
+
+    return (int)batch.size();
+}
+
+int IoRing::wait (int minComplete, int timeout)
+{
+    int64 deadline = timeout < 0 ? -1 : tickcount_us() + (int64)timeout * 1000;
+
+    submit();
+    if (m_fd >= 0) reap();
+
+    int handled = dispatch();
+
+    while (handled < minComplete && m_pending > 0)
+    {
+        if (m_fd < 0)
+        {
+            // only operations queued by the handlers are left to run
+            if (submit() == 0) break;
+
+            handled += dispatch();
+            continue;
+        }
+
+        submit();
+
+        if (deadline < 0)
+        {
+            enter(0, 1, IORING_ENTER_GETEVENTS);
+            reap();
+        }
+        else
+        {
+            int64 remain = deadline - tickcount_us();
+            if (remain <= 0) break;
+
+            // flushes completions which overflowed the ring back to it
+            enter(0, 0, IORING_ENTER_GETEVENTS);
+
+            if (reap() == 0)
+            {
+                // the ring polls readable while completions are waiting
+                pollfd fd = { m_fd, POLLIN, 0 };
+                ::poll(&fd, 1, (int)((remain + 999) / 1000));
+
+                reap();
+            }
+        }
+
+        handled += dispatch();
+    }
+
+    return handled;
+}
+
+bool IoRing::supported ()
+{
+    IoRing ring(1);
+    return ring.native();
+}
+
+//////////////////////////////////////////////////////////////////////////
+void IoRing::queue (int opcode, int fd, void* data, int size, int64 offset, int buffer, CompletionHandler handler, bool link)
+{
+    if (m_fd >= 0 && full())
+    {
+        // a full ring is handed over first, which splits a chain spanning the two batches
+        submit();
+
+        // the kernel refuses new entries while completions overflow, reaping takes them
+        if (full())
+        {
+            reap();
+            submit();
+        }
+
+        if (full()) throw IOException("IoRing submission queue is full");
+    }
+
+    int slot;
+
+    if (!m_free.empty())
+    {
+        slot = m_free.back();
+        m_free.pop_back();
+    }
+    else
+    {
+        slot = (int)m_slots.size();
+        m_slots.push_back(Operation());
+    }
+
+    Operation& op = m_slots[slot];
+    op.opcode  = opcode;
+    op.fd      = fd;
+    op.data    = (char*)data;
+    op.size    = size;
+    op.offset  = offset;
+    op.link    = link;
+    op.handler = handler;
+
+    m_pending++;
+
+    if (m_fd < 0)
+    {
+        m_submitQueue.push_back(slot);
+        return;
+    }
+
+    uint tail  = *m_sqTail;
+    uint index = tail & m_sqMask;
+
+    io_uring_sqe* sqe = (io_uring_sqe*)m_sqes + index;
+    memset(sqe, 0, sizeof(*sqe));
+
+    sqe->opcode    = (byte)opcode;
+    sqe->fd        = fd;
+    sqe->addr      = (uint64)(size_t)data;
+    sqe->len       = (uint)size;
+    sqe->off       = offset < 0 ? (uint64)-1 : (uint64)offset;  // -1 is the file position
+    sqe->user_data = (uint64)slot;
+
+    if (opcode == IORING_OP_SEND)   sqe->msg_flags = MSG_NOSIGNAL;
+    if (opcode == IORING_OP_SEND || opcode == IORING_OP_RECV || opcode == IORING_OP_FSYNC) sqe->off = 0;
+    if (opcode == IORING_OP_READ_FIXED || opcode == IORING_OP_WRITE_FIXED) sqe->buf_index = (ushort)buffer;
+    if (link) sqe->flags |= IOSQE_IO_LINK;
+
+    m_sqArray[index] = index;
+
+    // the entry has to be visible before the kernel sees the new tail
+    atomic_store(m_sqTail, tail + 1);
+    m_queued++;
+}
+
+bool IoRing::setup (int entries)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = io_uring_setup((uint)entries, &params);
+    if (fd < 0) return false;
+
+    // read, write, send and recv came with 5.6, like the probe itself
+    static const int required[] = { IORING_OP_READ, IORING_OP_WRITE, IORING_OP_SEND, IORING_OP_RECV, IORING_OP_FSYNC,
+                                    IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED };
+
+    std::vector<char> space(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+    io_uring_probe* probe = (io_uring_probe*)&space[0];
+
+    bool usable = io_uring_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+
+    for (size_t n = 0; usable && n < sizeof(required) / sizeof(required[0]); ++n)
+    {
+        usable = required[n] <= probe->last_op && (probe->ops[required[n]].flags & IO_URING_OP_SUPPORTED);
+    }
+
+    if (!usable)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+
+    m_sqRing = mmap(0, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (m_sqRing == MAP_FAILED) m_sqRing = 0;
+
+    m_cqRing = single ? m_sqRing : mmap(0, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (m_cqRing == MAP_FAILED) m_cqRing = 0;
+
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = mmap(0, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED) m_sqes = 0;
+
+    if (!m_sqRing || !m_cqRing || !m_sqes)
+    {
+        if (m_sqes) munmap(m_sqes, m_sqesSize);
+        if (m_cqRing && !single) munmap(m_cqRing, m_cqRingSize);
+        if (m_sqRing) munmap(m_sqRing, m_sqRingSize);
+
+        m_sqRing = m_cqRing = m_sqes = 0;
+        ::close(fd);
+        return false;
+    }
+
+    char* sq = (char*)m_sqRing;
+    m_sqHead    = (volatile uint*)(sq + params.sq_off.head);
+    m_sqTail    = (volatile uint*)(sq + params.sq_off.tail);
+    m_sqFlags   = (volatile uint*)(sq + params.sq_off.flags);
+    m_sqMask    = *(uint*)(sq + params.sq_off.ring_mask);
+    m_sqEntries = *(uint*)(sq + params.sq_off.ring_entries);
+    m_sqArray   = (uint*)(sq + params.sq_off.array);
+
+    char* cq = (char*)m_cqRing;
+    m_cqHead    = (volatile uint*)(cq + params.cq_off.head);
+    m_cqTail    = (volatile uint*)(cq + params.cq_off.tail);
+    m_cqMask    = *(uint*)(cq + params.cq_off.ring_mask);
+    m_cqes      = cq + params.cq_off.cqes;
+
+    m_fd = fd;
+    return true;
+}
+
+int IoRing::enter (int submit, int minComplete, int flags)
+{
+    for (;;)
+    {
+        int count = io_uring_enter(m_fd, (uint)submit, (uint)minComplete, (uint)flags);
+        if (count >= 0) return count;
+
+        if (errno == EINTR) continue;
+
+        // the completion ring is full, reaping makes room
+        if (errno == EBUSY || errno == EAGAIN) return 0;
+
+        throw IOException("io_uring_enter failed");
+    }
+}
+
+bool IoRing::full ()
+{
+    return *m_sqTail - atomic_load(m_sqHead) >= m_sqEntries;
+}
+
+int IoRing::reap ()
+{
+    int count = drain();
+
+    // completions which did not fit the ring wait in the kernel, and only
+    // come back to it through GETEVENTS
+    while (atomic_load(m_sqFlags) & IORING_SQ_CQ_OVERFLOW)
+    {
+        enter(0, 0, IORING_ENTER_GETEVENTS);
+
+        int num = drain();
+        if (num == 0) break;
+
+        count += num;
+    }
+
+    return count;
+}
+
+int IoRing::drain ()
+{
+    uint head = *m_cqHead;
+    uint tail = atomic_load(m_cqTail);
+    int count = 0;
+
+    for (; head != tail; ++head, ++count)
+    {
+        io_uring_cqe* cqe = (io_uring_cqe*)m_cqes + (head & m_cqMask);
+
+        Completion done = { (int)cqe->user_data, cqe->res };
+        m_completed.push_back(done);
+    }
+
+    // the kernel may reuse the entries now
+    atomic_store(m_cqHead, head);
+
+    return count;
+}
+
+int IoRing::perform (const Operation& op)
+{
+    for (;;)
+    {
+        ssize_t result = -1;
+
+        switch (op.opcode)
+        {
+        case IORING_OP_READ:
+        case IORING_OP_READ_FIXED:
+            result = op.offset < 0 ? ::read(op.fd, op.data, op.size) : ::pread(op.fd, op.data, op.size, op.offset);
+            break;
+
+        case IORING_OP_WRITE:
+        case IORING_OP_WRITE_FIXED:
+            result = op.offset < 0 ? ::write(op.fd, op.data, op.size) : ::pwrite(op.fd, op.data, op.size, op.offset);
+            break;
+
+        case IORING_OP_FSYNC:
+            result = ::fsync(op.fd);
+            break;
+
+        case IORING_OP_SEND:
+            result = ::send(op.fd, op.data, op.size, MSG_NOSIGNAL);
+            break;
+
+        case IORING_OP_RECV:
+            result = ::recv(op.fd, op.data, op.size, 0);
+            break;
+
+        default:
+            return -EINVAL;
+        }
+
+        if (result >= 0) return (int)result;
+        if (errno != EINTR) return -errno;
+    }
+}
+
+int IoRing::dispatch ()
+{
+    int count = 0;
+
+    while (!m_completed.empty())
+    {
+        Completion done = m_completed.front();
+        m_completed.pop_front();
+
+        // the handler may queue more operations and reuse the slot
+        CompletionHandler handler = m_slots[done.slot].handler;
+        m_slots[done.slot].handler.disconnect();
+        m_free.push_back(done.slot);
+        m_pending--;
+
+        try
+        {
+            handler.invoke(done.result);
+        }
+        catch (...)
+        {
+            logmsg("Exception was thrown in io completion handler\n");
+        }
+
+        count++;
+    }
+
+    return count;
+}
+
+END_NAMESPACE_LIB
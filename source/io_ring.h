@@ -0,0 +1,146 @@
+#ifndef LIB_IO_RING_H
+#define LIB_IO_RING_H
+
+#include "files.h"
+#include "socket.h"
+#include "delegate.h"
+
+#include <deque>
+
+BEGIN_NAMESPACE_LIB
+
+//////////////////////////////////////////////////////////////////////////
+// Asynchronous file and socket I/O over io_uring. Operations are queued to
+// the submission ring and handed to the kernel together by submit or wait,
+// one system call for the whole batch, and their handlers are invoked by
+// wait with the bytes transferred or a negative errno. A linked operation
+// starts after the previous one succeeded, the rest of a failed chain ends
+// with -ECANCELED. Registered buffers spare the kernel mapping the pages
+// for every operation.
+//
+// Without io_uring (old kernels, seccomp, io_uring_disabled) the same calls
+// run synchronously in submit with pread, pwrite, send and recv, so callers
+// need no second code path; a receive on a blocking socket waits there for
+// its data, so queue the matching send first. Not thread safe, like Reactor.
+class IoRing
+{
+public:
+    typedef delegate<void, int> CompletionHandler;
+
+    enum { DefaultEntries = 256 };
+
+public:
+    // kernel false selects the fallback, to compare the two
+    IoRing (int entries = DefaultEntries, bool kernel = true);
+
+    virtual ~IoRing ();
+
+    // true when the kernel ring is used, false for the synchronous fallback
+    bool    native      ()  { return m_fd >= 0; }
+
+    // the number of operations queued or in flight
+    int     pending     ()  { return m_pending; }
+
+    // offset -1 reads at the file position, link makes the next operation wait for this one
+    void    read        (int fd, void* data, int size, int64 offset, CompletionHandler handler, bool link = false);
+
+    void    write       (int fd, const void* data, int size, int64 offset, CompletionHandler handler, bool link = false);
+
+    void    read        (FileStream* file, void* data, int size, int64 offset, CompletionHandler handler, bool link = false);
+
+    void    write       (FileStream* file, const void* data, int size, int64 offset, CompletionHandler handler, bool link = false);
+
+    void    fsync       (FileStream* file, CompletionHandler handler, bool link = false);
+
+    void    send        (Socket* socket, const void* data, int size, CompletionHandler handler, bool link = false);
+
+    void    receive     (Socket* socket, void* data, int size, CompletionHandler handler, bool link = false);
+
+    // the buffers stay registered until the ring is deleted or registered again, only while nothing is pending
+    void    registerBuffers (const std::vector<iovec>& buffers);
+
+    // on a registered buffer, data has to lie within it
+    void    readFixed   (int fd, int buffer, void* data, int size, int64 offset, CompletionHandler handler, bool link = false);
+
+    void    writeFixed  (int fd, int buffer, const void* data, int size, int64 offset, CompletionHandler handler, bool link = false);
+
+    // hands the queued operations to the kernel, returns their number
+    int     submit      ();
+
+    // submits, then waits for at least minComplete completions or the timeout in milliseconds.
+    // invokes the handlers and returns their number
+    int     wait        (int minComplete = 1, int timeout = -1);
+
+    // io_uring_setup works and knows the operations used here
+    static bool supported ();
+
+protected:
+    // what the fallback needs to run an operation, and the handler of both paths
+    struct Operation
+    {
+        int                 opcode;
+        int                 fd;
+        char*               data;
+        int                 size;
+        int64               offset;
+        bool                link;
+        CompletionHandler   handler;
+    };
+
+    struct Completion
+    {
+        int                 slot;
+        int                 result;
+    };
+
+    void    queue           (int opcode, int fd, void* data, int size, int64 offset, int buffer, CompletionHandler handler, bool link);
+
+    bool    full            ();
+
+    int     drain           ();
+
+    bool    setup           (int entries);
+
+    int     enter           (int submit, int minComplete, int flags);
+
+    int     reap            ();
+
+    int     perform         (const Operation& op);
+
+    int     dispatch        ();
+
+protected:
+    int                     m_fd;           // the ring, -1 for the fallback
+    int                     m_pending;
+    int                     m_queued;       // not submitted yet
+    bool                    m_registered;   // m_buffers are known to the kernel
+
+    // the mappings of the kernel ring
+    void*                   m_sqRing;
+    void*                   m_cqRing;
+    size_t                  m_sqRingSize;
+    size_t                  m_cqRingSize;
+    void*                   m_sqes;
+    size_t                  m_sqesSize;
+
+    volatile uint*          m_sqHead;
+    volatile uint*          m_sqTail;
+    volatile uint*          m_sqFlags;
+    uint                    m_sqMask;
+    uint                    m_sqEntries;
+    uint*                   m_sqArray;
+    volatile uint*          m_cqHead;
+    volatile uint*          m_cqTail;
+    uint                    m_cqMask;
+    void*                   m_cqes;
+
+    std::vector<Operation>  m_slots;        // indexed by the user data of the kernel
+    std::vector<int>        m_free;
+    std::vector<int>        m_submitQueue;  // the fallback runs them in submit
+    std::deque<Completion>  m_completed;
+    std::vector<iovec>      m_buffers;
+};
+
+END_NAMESPACE_LIB
+
+#endif //LIB_IO_RING_H
@@ -0,0 +1,204 @@
+#include "mmap_stream.h"
+#include "errors.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+BEGIN_NAMESPACE_LIB
+
+static int64 page_size ()
+{
+    static const int64 size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+//////////////////////////////////////////////////////////////////////////
+MmapStream::MmapStream (const char* path, int access) : m_fd(-1), m_data(0), m_size(0), m_pos(0), m_writable(false)
+{
+    init(path, access);
+}
+
+MmapStream::MmapStream (const string& path, int access) : m_fd(-1), m_data(0), m_size(0), m_pos(0), m_writable(false)
+{
+    init(path.c_str(), access);
+}
+
+MmapStream::~MmapStream ()
+{
+    try { close(); } catch (...) {}
+}
+
+void MmapStream::init (const char* path, int access)
+{
+    m_writable = hasFlag(access, FileAccess::WriteOnly);
+
+    // a shared mapping needs the file readable as well
+    m_fd = ::open(path, (m_writable ? O_RDWR : O_RDONLY) | O_NOCTTY);
+    if (m_fd < 0) throw IOException("File could not be opened");
+
+    struct stat st;
+
+    try
+    {
+        if (fstat(m_fd, &st) != 0) throw IOException("File could not be opened");
+        remap(st.st_size);
+    }
+    catch (...)
+    {
+        close();
+        throw;
+    }
+}
+
+// an empty file has no mapping, data() is null then
+void MmapStream::remap (int64 size)
+{
+    if (size == m_size && (m_data || size == 0)) return;
+
+    void* data = MAP_FAILED;
+
+    if (size == 0)
+    {
+        munmap(m_data, m_size);
+        m_data = 0;
+        m_size = 0;
+        return;
+    }
+
+    if (m_data == 0)
+    {
+        int prot = m_writable ? PROT_READ | PROT_WRITE : PROT_READ;
+        data = mmap(0, size, prot, MAP_SHARED, m_fd, 0);
+    }
+    else
+    {
+        // moves the pages in the page tables instead of faulting them in again
+        data = mremap(m_data, m_size, size, MREMAP_MAYMOVE);
+    }
+
+    if (data == MAP_FAILED) throw IOException("File could not be mapped");
+
+    m_data = (char*)data;
+    m_size = size;
+}
+
+void MmapStream::advise (Advice advice, int64 offset, int64 length)
+{
+    if (m_data == 0 || offset < 0 || offset >= m_size) return;
+    if (length < 0 || length > m_size - offset) length = m_size - offset;
+
+    static const int advices[] = { MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED, MADV_DONTNEED };
+
+    // the range has to start on a page
+    int64 begin = offset / page_size() * page_size();
+
+    // only a hint, failing is harmless
+    madvise(m_data + begin, offset + length - begin, advices[advice]);
+}
+
+int64 MmapStream::refresh ()
+{
+    if (m_fd < 0) throw InvalidOperationException();
+
+    struct stat st;
+    if (fstat(m_fd, &st) != 0) throw IOException();
+
+    remap(st.st_size);
+
+    return m_size;
+}
+
+void MmapStream::sync (int64 offset, int64 length)
+{
+    if (m_data == 0 || !m_writable || offset < 0 || offset >= m_size) return;
+    if (length < 0 || length > m_size - offset) length = m_size - offset;
+
+    int64 begin = offset / page_size() * page_size();
+
+    if (msync(m_data + begin, offset + length - begin, MS_SYNC) != 0) throw IOException();
+}
+
+bool MmapStream::mappable (const char* path, int64 minSize)
+{
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) return false;
+
+    // files of /proc and /sys report no size, they have to be read
+    return st.st_size > 0 && st.st_size >= minSize;
+}
+
+//////////////////////////////////////////////////////////////////////////
+int MmapStream::read ()
+{
+    if (m_pos >= m_size) return -1;
+    return (byte)m_data[m_pos++];
+}
+
+int MmapStream::read (void* data, int offset, int size)
+{
+    if (size <= 0 || m_pos >= m_size) return 0;
+    if (size > m_size - m_pos) size = (int)(m_size - m_pos);
+
+    memcpy((char*)data + offset, m_data + m_pos, size);
+    m_pos += size;
+
+    return size;
+}
+
+int MmapStream::write (const void* data, int offset, int size)
+{
+    if (!canWrite()) throw NotSupportedException();
+    if (size <= 0) return 0;
+
+    if (m_pos + size > m_size) setLength64(m_pos + size);
+
+    memcpy(m_data + m_pos, (const char*)data + offset, size);
+    m_pos += size;
+
+    return size;
+}
+
+void MmapStream::flush ()
+{
+    sync();
+}
+
+void MmapStream::close ()
+{
+    if (m_data) munmap(m_data, m_size);
+    if (m_fd >= 0) ::close(m_fd);
+
+    m_fd   = -1;
+    m_data = 0;
+    m_size = 0;
+    m_pos  = 0;
+}
+
+int64 MmapStream::seek64 (int64 offset, int origin)
+{
+    int64 pos = offset;
+
+    if (origin == SeekCurrent)  pos += m_pos;
+    else if (origin == SeekEnd) pos += m_size;
+
+    // like lseek, beyond the end is fine and a write there grows the file
+    if (pos < 0) return -1;
+
+    m_pos = pos;
+    return m_pos;
+}
+
+void MmapStream::setLength64 (int64 value)
+{
+    if (!canWrite()) throw NotSupportedException();
+    if (value < 0) throw InvalidArgumentException();
+
+    if (ftruncate(m_fd, value) != 0) throw IOException("File could not be resized");
+
+    remap(value);
+}
+
+END_NAMESPACE_LIB
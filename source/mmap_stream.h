@@ -0,0 +1,126 @@
+#ifndef LIB_MMAP_STREAM_H
+#define LIB_MMAP_STREAM_H
+
+#include "stream.h"
+#include "files.h"
+
+BEGIN_NAMESPACE_LIB
+
+//////////////////////////////////////////////////////////////////////////
+// A file mapped into memory. data() is the whole file, so readers and
+// views can work on it without copying:
+//
+//     MmapStream map(path);
+//     map.advise(MmapStream::Sequential);
+//
+//     StreamReader reader(map.data(), 0, map.length());
+//     JsonNode* json = JsonNode::load(reader);
+//
+//     XmlReader xml(map.data(), map.length());
+//     Buffer view(map.data(), map.length(), true);     // read-only
+//
+// Mapping is explicit: the readers opened from a file name keep reading
+// it through FileStream, which sees appended data and follows seeks.
+//
+// The mapping is shared: changes to the file show through data(), and
+// with ReadWrite the writes through data() or write() go to the file. The
+// stream methods keep a position like FileStream; writing past the end
+// grows the file. data() moves whenever the mapping does: after refresh(),
+// setLength() and a write which grows the file. Truncating the file from
+// elsewhere while it is mapped makes access beyond the new end raise SIGBUS.
+class MmapStream : public Stream
+{
+public:
+    enum Advice
+    {
+        Normal,
+        Sequential,     // aggressive read-ahead, pages behind are dropped early
+        Random,         // no read-ahead
+        WillNeed,       // start reading the range in now
+        DontNeed,       // the range may be dropped
+    };
+
+    MmapStream (const char* path, int access = FileAccess::ReadOnly);
+
+    MmapStream (const string& path, int access = FileAccess::ReadOnly);
+
+    virtual ~MmapStream ();
+
+public:
+    const char* data        ()  const   { return m_data; }
+
+    // writable with ReadWrite access only
+    char*       data        ()          { return m_data; }
+
+    const char* current     ()  const   { return m_data + m_pos; }
+
+    int64       size        ()  const   { return m_size; }
+
+    int64       remaining   ()  const   { return m_size - m_pos; }
+
+    // hints the kernel how the range is going to be read, length < 0 up to the end
+    void        advise      (Advice advice, int64 offset = 0, int64 length = -1);
+
+    // maps what was appended to the file since, returns the new size
+    int64       refresh     ();
+
+    // writes the dirty pages of the range back and waits for them
+    void        sync        (int64 offset = 0, int64 length = -1);
+
+    // a regular file of at least minSize bytes, which is worth mapping
+    static bool mappable    (const char* path, int64 minSize = 1);
+
+public: // stream methods
+    virtual bool canRead    ()  { return m_fd >= 0; }
+
+    virtual bool canWrite   ()  { return m_fd >= 0 && m_writable; }
+
+    virtual bool canSeek    ()  { return m_fd >= 0; }
+
+    virtual int  read       ();
+
+    virtual int  read       (void* data, int offset, int size);
+
+    virtual int  write      (const void* data, int offset, int size);
+
+    virtual void flush      ();
+
+    virtual void close      ();
+
+    virtual int  seek       (int offset, int origin)    { return (int)seek64(offset, origin); }
+
+    virtual int  position   ()  { return (int)m_pos;  }
+
+    virtual int  length     ()  { return (int)m_size; }
+
+    virtual void setLength  (int value) { setLength64(value); }
+
+    virtual int64 seek64    (int64 offset, int origin);
+
+    virtual int64 position64 () { return m_pos;  }
+
+    virtual int64 length64  ()  { return m_size; }
+
+    // resizes the file and maps it again, ReadWrite only
+    virtual void setLength64 (int64 value);
+
+protected:
+    void        init        (const char* path, int access);
+
+    void        remap       (int64 size);
+
+protected:
+    int         m_fd;
+    char*       m_data;
+    int64       m_size;
+    int64       m_pos;
+    bool        m_writable;
+
+private:
+    MmapStream (const MmapStream&);
+    MmapStream& operator = (const MmapStream&);
+};
+
+END_NAMESPACE_LIB
+
+#endif //LIB_MMAP_STREAM_H
@@ -0,0 +1,326 @@
+#include "reactor.h"
+#include "utils.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <errno.h>
+
+BEGIN_NAMESPACE_LIB
+
+static int epoll_events (int events)
+{
+    int value = EPOLLET | EPOLLRDHUP;
+
+    if (hasFlag(events, Socket::SelectRead )) value |= EPOLLIN;
+    if (hasFlag(events, Socket::SelectWrite)) value |= EPOLLOUT;
+
+    return value;
+}
+
+static int select_mode (int events)
+{
+    int value = Socket::SelectNone;
+
+    if (events & (EPOLLIN | EPOLLRDHUP)) value |= Socket::SelectRead;
+    if (events & EPOLLOUT)               value |= Socket::SelectWrite;
+    if (events & (EPOLLERR | EPOLLHUP))  value |= Socket::SelectError;
+
+    return value;
+}
+
+//////////////////////////////////////////////////////////////////////////
+Reactor::Reactor ()
+    : m_epoll(-1), m_wakeup(-1), m_count(0), m_nextTimer(InvalidTimer), m_running(false), m_stopping(false), m_threadId(Thread::currentId())
+{
+    m_epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll < 0) throw IOException("Reactor could not create epoll");
+
+    m_wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wakeup < 0) { ::close(m_epoll); throw IOException("Reactor could not create eventfd"); }
+
+    epoll_event ev = { 0 };
+    ev.events = EPOLLIN;
+    ev.data.ptr = 0; // null channel marks the wakeup descriptor
+
+    epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeup, &ev);
+}
+
+Reactor::~Reactor ()
+{
+    for (size_t n = 0; n < m_channels.size(); ++n) delete m_channels[n];
+    for (TimerQueue::iterator it = m_timers.begin(); it != m_timers.end(); ++it) delete it->second;
+
+    purgeChannels();
+    deleteItems(m_tasks.begin(), m_tasks.end());
+
+    ::close(m_wakeup);
+    ::close(m_epoll);
+}
+
+Reactor::Channel* Reactor::channelOf (Socket* socket)
+{
+    socket_t fd = socket->handle();
+    return (fd >= 0 && fd < (int)m_channels.size()) ? m_channels[fd] : 0;
+}
+
+void Reactor::add (Socket* socket, int events, SocketHandler handler)
+{
+    socket_t fd = socket->handle();
+    if (fd < 0) throw InvalidArgumentException("Reactor can not add a closed socket");
+    if (channelOf(socket)) throw InvalidOperationException("Socket was already added to reactor");
+
+    socket->setBlocking(false);
+
+    Channel* channel = new Channel();
+    channel->socket  = socket;
+    channel->handler = handler;
+    channel->events  = events;
+    channel->removed = false;
+
+    epoll_event ev = { 0 };
+    ev.events = epoll_events(events);
+    ev.data.ptr = channel;
+
+    if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        delete channel;
+        throw SocketException("Reactor could not add socket");
+    }
+
+    if (fd >= (int)m_channels.size()) m_channels.resize(fd + 1, 0);
+
+    m_channels[fd] = channel;
+    m_count++;
+}
+
+void Reactor::modify (Socket* socket, int events)
+{
+    Channel* channel = channelOf(socket);
+    if (channel == 0) throw NotFoundException("Socket was not added to reactor");
+
+    if (channel->events == events) return;
+
+    epoll_event ev = { 0 };
+    ev.events = epoll_events(events);
+    ev.data.ptr = channel;
+
+    if (epoll_ctl(m_epoll, EPOLL_CTL_MOD, socket->handle(), &ev) < 0) throw SocketException("Reactor could not modify socket");
+
+    channel->events = events;
+}
+
+void Reactor::remove (Socket* socket)
+{
+    Channel* channel = channelOf(socket);
+    if (channel == 0) return;
+
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, socket->handle(), 0);
+
+    // events of this round may still refer to the channel, free it later
+    channel->removed = true;
+    channel->handler.disconnect();
+
+    m_channels[socket->handle()] = 0;
+    m_removed.push_back(channel);
+    m_count--;
+}
+
+bool Reactor::contains (Socket* socket)
+{
+    return channelOf(socket) != 0;
+}
+
+int Reactor::addTimer (int milliseconds, TimerHandler handler, bool repeat)
+{
+    if (milliseconds < 0) throw InvalidArgumentException("Timer interval can not be negative");
+
+    if (++m_nextTimer == InvalidTimer) ++m_nextTimer;
+
+    Timer* timer = new Timer();
+    timer->id        = m_nextTimer;
+    timer->interval  = milliseconds;
+    timer->handler   = handler;
+    timer->repeat    = repeat;
+    timer->cancelled = false;
+
+    m_timers.insert(std::make_pair(tickcount_us() + milliseconds * 1000LL, timer));
+    m_timerIds[timer->id] = timer;
+
+    return timer->id;
+}
+
+bool Reactor::cancelTimer (int timerId)
+{
+    TimerIndex::iterator it = m_timerIds.find(timerId);
+    if (it == m_timerIds.end()) return false;
+
+    // the timer stays queued until its deadline, it is just skipped then
+    it->second->cancelled = true;
+    m_timerIds.erase(it);
+
+    return true;
+}
+
+void Reactor::queueTask (Task* task)
+{
+    m_taskLock.lock();
+    m_tasks.push_back(task);
+    m_taskLock.unlock();
+
+    wakeup();
+}
+
+void Reactor::wakeup ()
+{
+    uint64 one = 1;
+    while (::write(m_wakeup, &one, sizeof(one)) < 0 && errno == EINTR);
+}
+
+void Reactor::stop ()
+{
+    // run() clears the request only when it returns, so a stop issued
+    // before the loop started is not lost
+    m_stopping = true;
+    wakeup();
+}
+
+void Reactor::run ()
+{
+    m_running = true;
+
+    while (!m_stopping) runOnce(-1);
+
+    m_stopping = false;
+    m_running  = false;
+}
+
+int Reactor::nextTimeout (int timeout)
+{
+    if (m_timers.empty()) return timeout;
+
+    int64 remain = m_timers.begin()->first - tickcount_us();
+    int due = remain <= 0 ? 0 : (int)((remain + 999) / 1000);
+
+    return (timeout < 0 || due < timeout) ? due : timeout;
+}
+
+int Reactor::runOnce (int timeout)
+{
+    epoll_event events[MaxEvents];
+
+    m_threadId = Thread::currentId();
+
+    int num = epoll_wait(m_epoll, events, MaxEvents, nextTimeout(timeout));
+
+    if (num < 0)
+    {
+        if (errno != EINTR) throw IOException("Reactor failed to wait epoll");
+        num = 0;
+    }
+
+    int dispatched = 0;
+
+    for (int n = 0; n < num; ++n)
+    {
+        Channel* channel = (Channel*)events[n].data.ptr;
+
+        if (channel == 0)
+        {
+            uint64 value;
+            while (::read(m_wakeup, &value, sizeof(value)) < 0 && errno == EINTR);
+            continue;
+        }
+
+        if (channel->removed) continue;
+
+        try
+        {
+            channel->handler.invoke(channel->socket, select_mode(events[n].events));
+        }
+        catch (...)
+        {
+            logmsg("Exception was thrown in reactor socket handler\n");
+        }
+
+        dispatched++;
+    }
+
+    purgeChannels();
+    processTimers();
+    processTasks();
+
+    return dispatched;
+}
+
+void Reactor::processTimers ()
+{
+    int64 now = tickcount_us();
+
+    // take the due timers out first, so that zero interval repeats run once per round
+    std::vector<Timer*> expired;
+
+    while (!m_timers.empty() && m_timers.begin()->first <= now)
+    {
+        expired.push_back(m_timers.begin()->second);
+        m_timers.erase(m_timers.begin());
+    }
+
+    for (size_t n = 0; n < expired.size(); ++n)
+    {
+        Timer* timer = expired[n];
+
+        if (!timer->cancelled)
+        {
+            try
+            {
+                timer->handler.invoke();
+            }
+            catch (...)
+            {
+                logmsg("Exception was thrown in reactor timer handler\n");
+            }
+        }
+
+        // the handler may have cancelled its own timer
+        if (timer->repeat && !timer->cancelled)
+        {
+            m_timers.insert(std::make_pair(now + timer->interval * 1000LL, timer));
+        }
+        else
+        {
+            if (!timer->cancelled) m_timerIds.erase(timer->id);
+            delete timer;
+        }
+    }
+}
+
+void Reactor::processTasks ()
+{
+    std::vector<Task*> tasks;
+
+    m_taskLock.lock();
+    tasks.swap(m_tasks);
+    m_taskLock.unlock();
+
+    for (size_t n = 0; n < tasks.size(); ++n)
+    {
+        try
+        {
+            tasks[n]->run();
+        }
+        catch (...)
+        {
+            logmsg("Exception was thrown in reactor task\n");
+        }
+
+        delete tasks[n];
+    }
+}
+
+void Reactor::purgeChannels ()
+{
+    deleteItems(m_removed.begin(), m_removed.end());
+    m_removed.clear();
+}
+
+END_NAMESPACE_LIB
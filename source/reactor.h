@@ -0,0 +1,119 @@
+#ifndef LIB_REACTOR_H
+#define LIB_REACTOR_H
+
+#include "socket.h"
+#include "thread.h"
+#include "task.h"
+#include "delegate.h"
+
+#include <map>
+
+BEGIN_NAMESPACE_LIB
+
+//////////////////////////////////////////////////////////////////////////
+// Event loop dispatching the readiness of many sockets with edge-triggered
+// epoll. Handlers are invoked on the loop thread with the ready mask made of
+// Socket::SelectMode flags, and must read or write until WouldBlock since an
+// edge is only reported once. Registration and timers are not thread safe,
+// use queueTask to reach the loop from other threads.
+class Reactor
+{
+public:
+    typedef delegate2<void, Socket*, int> SocketHandler;
+    typedef delegate<void, void>          TimerHandler;
+
+    enum { InvalidTimer = 0, MaxEvents = 256 };
+
+public:
+    Reactor ();
+
+    virtual ~Reactor ();
+
+    // the socket is switched to non-blocking mode, errors and hangups are always reported
+    void    add         (Socket* socket, int events, SocketHandler handler);
+
+    void    modify      (Socket* socket, int events);
+
+    void    remove      (Socket* socket);
+
+    bool    contains    (Socket* socket);
+
+    int     count       ()  { return m_count; }
+
+
+    // returns a timer id for cancelTimer, repeated timers keep firing until cancelled
+    int     addTimer    (int milliseconds, TimerHandler handler, bool repeat = false);
+
+    bool    cancelTimer (int timerId);
+
+
+    // thread safe, the task is run on the loop thread and deleted afterwards
+    void    queueTask   (Task* task);
+
+    // returns the number of sockets dispatched, timeout is in milliseconds
+    int     runOnce     (int timeout = -1);
+
+    void    run         ();
+
+    // thread safe, makes run() return after the current iteration, or as
+    // soon as it is entered when the loop has not started yet
+    void    stop        ();
+
+    void    wakeup      ();
+
+    bool    running     ()  { return m_running; }
+
+    bool    inLoopThread()  { return m_threadId == Thread::currentId(); }
+
+protected:
+    struct Channel
+    {
+        Socket*         socket;
+        SocketHandler   handler;
+        int             events;
+        bool            removed;
+    };
+
+    struct Timer
+    {
+        int             id;
+        int             interval;
+        TimerHandler    handler;
+        bool            repeat;
+        bool            cancelled;
+    };
+
+    typedef std::multimap<int64, Timer*> TimerQueue;
+    typedef std::map<int, Timer*>        TimerIndex;
+
+    Channel* channelOf      (Socket* socket);
+
+    int     nextTimeout     (int timeout);
+
+    void    processTimers   ();
+
+    void    processTasks    ();
+
+    void    purgeChannels   ();
+
+protected:
+    int                     m_epoll;
+    int                     m_wakeup;
+    int                     m_count;
+    int                     m_nextTimer;
+    volatile bool           m_running;
+    volatile bool           m_stopping;
+    thread_t                m_threadId;
+
+    std::vector<Channel*>   m_channels; // indexed by socket handle
+    std::vector<Channel*>   m_removed;  // freed after each dispatch round
+    TimerQueue              m_timers;
+    TimerIndex              m_timerIds;
+
+    Mutex                   m_taskLock;
+    std::vector<Task*>      m_tasks;
+};
+
+END_NAMESPACE_LIB
+
+#endif //LIB_REACTOR_H
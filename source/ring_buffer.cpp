@@ -0,0 +1,327 @@
+#include "ring_buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+BEGIN_NAMESPACE_LIB
+
+// an anonymous file to map twice, memfd_create where the kernel has it (3.17)
+static int create_backing (size_t size)
+{
+    int fd = -1;
+
+#ifdef __NR_memfd_create
+    fd = (int)syscall(__NR_memfd_create, "ring-buffer", 0);
+#endif
+
+    if (fd < 0)
+    {
+        char path[] = "/dev/shm/ring-buffer-XXXXXX";
+        fd = mkstemp(path);
+
+        if (fd < 0)
+        {
+            strcpy(path, "/tmp/ring-buffer-XXXXXX");
+            fd = mkstemp(path);
+        }
+
+        if (fd >= 0) unlink(path);
+    }
+
+    if (fd >= 0 && ftruncate(fd, size) != 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+
+    return fd;
+}
+
+RingBuffer::RingBuffer (int capacity, const Endian& endian) : m_data(0), m_capacity(0), m_head(0), m_count(0), m_endian(endian)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    if (capacity < 1) capacity = 1;
+
+    size_t size = (size_t)((capacity + page - 1) / page * page);
+
+    int fd = create_backing(size);
+    if (fd < 0) throw IOException("RingBuffer could not create its backing file");
+
+    // reserve both halves first, then map the file over each of them
+    char* base = (char*)mmap(0, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    bool mapped = base != MAP_FAILED
+               && mmap(base,        size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED
+               && mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED;
+
+    // the mappings keep the file alive
+    ::close(fd);
+
+    if (!mapped)
+    {
+        if (base != MAP_FAILED) munmap(base, size * 2);
+        throw IOException("RingBuffer could not map its pages");
+    }
+
+    m_data     = base;
+    m_capacity = (int)size;
+}
+
+RingBuffer::~RingBuffer ()
+{
+    if (m_data) munmap(m_data, (size_t)m_capacity * 2);
+}
+
+int RingBuffer::find (char ch, int offset) const
+{
+    if (offset < 0 || offset >= m_count) return -1;
+
+    const char* p = (const char*)memchr(m_data + m_head + offset, ch, m_count - offset);
+
+    return p ? (int)(p - (m_data + m_head)) : -1;
+}
+
+//////////////////////////////////////////////////////////////////////////
+int RingBuffer::read ()
+{
+    if (m_count == 0) return -1;
+
+    byte value = (byte)m_data[m_head];
+    advance(1);
+
+    return value;
+}
+
+void RingBuffer::write (byte value)
+{
+    assertFree(1);
+    m_data[m_head + m_count++] = (char)value;
+}
+
+int RingBuffer::read (void* data, int offset, int size)
+{
+    if (size > m_count) size = m_count;
+    if (size <= 0) return 0;
+
+    memcpy((char*)data + offset, m_data + m_head, size);
+    advance(size);
+
+    return size;
+}
+
+int RingBuffer::write (const void* data, int offset, int size)
+{
+    if (size <= 0) return 0;
+
+    if (freeSpace() == 0) throw BufferOverflowException();
+    if (size > freeSpace()) size = freeSpace();
+
+    memcpy(end(), (const char*)data + offset, size);
+    m_count += size;
+
+    return size;
+}
+
+//////////////////////////////////////////////////////////////////////////
+char RingBuffer::readChar ()
+{
+    assertLen(1);
+    char value = m_data[m_head];
+    advance(1);
+    return value;
+}
+
+byte RingBuffer::readByte ()
+{
+    return (byte)readChar();
+}
+
+short RingBuffer::readInt16 ()
+{
+    assertLen(2);
+    short value = m_endian.readInt16(current());
+    advance(2);
+    return value;
+}
+
+ushort RingBuffer::readUInt16 ()
+{
+    assertLen(2);
+    ushort value = m_endian.readUInt16(current());
+    advance(2);
+    return value;
+}
+
+int RingBuffer::readInt32 ()
+{
+    assertLen(4);
+    int value = m_endian.readInt32(current());
+    advance(4);
+    return value;
+}
+
+uint RingBuffer::readUInt32 ()
+{
+    assertLen(4);
+    uint value = m_endian.readUInt32(current());
+    advance(4);
+    return value;
+}
+
+int64 RingBuffer::readInt64 ()
+{
+    assertLen(8);
+    int64 value = m_endian.readInt64(current());
+    advance(8);
+    return value;
+}
+
+uint64 RingBuffer::readUInt64 ()
+{
+    assertLen(8);
+    uint64 value = m_endian.readUInt64(current());
+    advance(8);
+    return value;
+}
+
+float RingBuffer::readFloat ()
+{
+    assertLen(4);
+    float value = m_endian.readFloat(current());
+    advance(4);
+    return value;
+}
+
+double RingBuffer::readDouble ()
+{
+    assertLen(8);
+    double value = m_endian.readDouble(current());
+    advance(8);
+    return value;
+}
+
+string RingBuffer::readString (int size, bool trimNull)
+{
+    assertLen(size);
+
+    const char* p = current();
+    int len = size;
+
+    if (trimNull)
+    {
+        const char* nul = (const char*)memchr(p, 0, size);
+        if (nul) len = (int)(nul - p);
+    }
+
+    string result(p, len);
+    advance(size);
+
+    return result;
+}
+
+byte RingBuffer::peekByte (int offset) const
+{
+    assertLen(offset + 1);
+    return (byte)m_data[m_head + offset];
+}
+
+ushort RingBuffer::peekUInt16 (int offset) const
+{
+    assertLen(offset + 2);
+    return m_endian.readUInt16(current() + offset);
+}
+
+uint RingBuffer::peekUInt32 (int offset) const
+{
+    assertLen(offset + 4);
+    return m_endian.readUInt32(current() + offset);
+}
+
+uint64 RingBuffer::peekUInt64 (int offset) const
+{
+    assertLen(offset + 8);
+    return m_endian.readUInt64(current() + offset);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void RingBuffer::append (const void* data, int offset, int size)
+{
+    if (size <= 0) return;
+
+    assertFree(size);
+    memcpy(end(), (const char*)data + offset, size);
+    m_count += size;
+}
+
+void RingBuffer::appendByte (byte value, int count)
+{
+    if (count <= 0) return;
+
+    assertFree(count);
+    memset(end(), value, count);
+    m_count += count;
+}
+
+void RingBuffer::appendInt16 (short value)
+{
+    value = m_endian.transform16(value);
+    append(&value, 0, 2);
+}
+
+void RingBuffer::appendUInt16 (ushort value)
+{
+    value = m_endian.transform16(value);
+    append(&value, 0, 2);
+}
+
+void RingBuffer::appendInt32 (int value)
+{
+    value = m_endian.transform32(value);
+    append(&value, 0, 4);
+}
+
+void RingBuffer::appendUInt32 (uint value)
+{
+    value = m_endian.transform32(value);
+    append(&value, 0, 4);
+}
+
+void RingBuffer::appendInt64 (int64 value)
+{
+    value = m_endian.transform64(value);
+    append(&value, 0, 8);
+}
+
+void RingBuffer::appendUInt64 (uint64 value)
+{
+    value = m_endian.transform64(value);
+    append(&value, 0, 8);
+}
+
+void RingBuffer::appendFloat (float value)
+{
+    append(&value, 0, 4);
+}
+
+void RingBuffer::appendDouble (double value)
+{
+    append(&value, 0, 8);
+}
+
+void RingBuffer::appendString (const string& value, int count)
+{
+    int size = value.size();
+
+    if (count < 0) count = size;
+    else if (size > count) size = count;
+
+    assertFree(count);
+
+    append(value.c_str(), 0, size);
+    appendByte(0, count - size);
+}
+
+END_NAMESPACE_LIB
@@ -0,0 +1,168 @@
+#ifndef LIB_RING_BUFFER_H
+#define LIB_RING_BUFFER_H
+
+#include "stream.h"
+#include "binary.h"
+#include "errors.h"
+
+BEGIN_NAMESPACE_LIB
+
+//////////////////////////////////////////////////////////////////////////
+// A circular byte buffer for continuous capture. The same pages are mapped
+// twice in a row, so the unread bytes from current() and the free space
+// from end() are always contiguous, even across the wrap point, and
+// consuming data never moves it the way Buffer::compact does:
+//
+//     int num = driver->read(ring.end(), ring.freeSpace());
+//     if (num > 0) ring.extendLen(num);
+//
+//     while (ring.remaining() >= PacketSize)
+//     {
+//         decode(ring.current());
+//         ring.forward(PacketSize);
+//     }
+//
+// The capacity is rounded up to whole pages. Appending beyond it throws
+// BufferOverflowException. Not thread safe, like Buffer.
+class RingBuffer : public Stream
+{
+public:
+    RingBuffer (int capacity, const Endian& endian = Endian::Default);
+
+    virtual ~RingBuffer ();
+
+public:
+    ByteOrder   order       ()  const       { return m_endian.order(); }
+
+    void        setOrder    (ByteOrder val) { m_endian.setOrder(val);  }
+
+    int         capacity    ()  const       { return m_capacity; }
+
+    // unread bytes, contiguous from current()
+    int         remaining   ()  const       { return m_count; }
+
+    // writable bytes, contiguous from end()
+    int         freeSpace   ()  const       { return m_capacity - m_count; }
+
+    bool        empty       ()  const       { return m_count == 0; }
+
+    const char* current     ()  const       { return m_data + m_head; }
+
+    char*       current     ()              { return m_data + m_head; }
+
+    char*       end         ()              { return m_data + m_head + m_count; }
+
+    // consumes bytes
+    void        forward     (int numBytes)  { assertLen(numBytes); advance(numBytes); }
+
+    // commits bytes written to end() directly
+    void        extendLen   (int numBytes)  { if (numBytes < 0 || numBytes > freeSpace()) throw BufferOverflowException(); m_count += numBytes; }
+
+    void        clear       ()              { m_head = 0; m_count = 0; }
+
+    char        operator [] (int index) const   { return m_data[m_head + index]; }
+
+    // the offset from current() of the first ch, or -1
+    int         find        (char ch, int offset = 0) const;
+
+public: // stream methods
+    virtual bool canRead    ()  { return true;  }
+
+    virtual bool canWrite   ()  { return true;  }
+
+    virtual bool canSeek    ()  { return false; }
+
+    virtual int  length     ()  { return m_count; }
+
+    virtual int  read       ();
+
+    virtual void write      (byte value);
+
+    // reads up to size unread bytes, zero when empty
+    virtual int  read       (void* data, int offset, int size);
+
+    // appends up to the free space, returns the bytes taken. Throws BufferOverflowException
+    // when nothing fits, so writeBytes over a full ring fails instead of spinning
+    virtual int  write      (const void* data, int offset, int size);
+
+public: // binary read / append methods, at current() and end()
+    char        readChar    ();
+
+    byte        readByte    ();
+
+    short       readInt16   ();
+
+    ushort      readUInt16  ();
+
+    int         readInt32   ();
+
+    uint        readUInt32  ();
+
+    int64       readInt64   ();
+
+    uint64      readUInt64  ();
+
+    float       readFloat   ();
+
+    double      readDouble  ();
+
+    string      readString  (int size, bool trimNull = true);
+
+
+    byte        peekByte    (int offset = 0) const;
+
+    ushort      peekUInt16  (int offset = 0) const;
+
+    uint        peekUInt32  (int offset = 0) const;
+
+    uint64      peekUInt64  (int offset = 0) const;
+
+
+    void        append      (const void* data, int offset, int size);
+
+    void        appendBytes (const void* data, int size)  { append(data, 0, size); }
+
+    void        appendByte  (byte value, int count = 1);
+
+    void        appendChar  (char value, int count = 1)   { appendByte(value, count); }
+
+    void        appendInt16 (short value);
+
+    void        appendUInt16 (ushort value);
+
+    void        appendInt32 (int value);
+
+    void        appendUInt32 (uint value);
+
+    void        appendInt64 (int64 value);
+
+    void        appendUInt64 (uint64 value);
+
+    void        appendFloat (float value);
+
+    void        appendDouble (double value);
+
+    void        appendString (const string& value, int count = -1);
+
+protected:
+    void        assertLen   (int len) const { if (len < 0 || len > m_count) throw IndexOutOfRangeException(); }
+
+    void        assertFree  (int len) const { if (len > m_capacity - m_count) throw BufferOverflowException(); }
+
+    void        advance     (int numBytes)  { m_head += numBytes; if (m_head >= m_capacity) m_head -= m_capacity; m_count -= numBytes; }
+
+protected:
+    char*   m_data;         // the capacity mapped twice in a row
+    int     m_capacity;
+    int     m_head;         // read offset, below the capacity
+    int     m_count;
+    Endian  m_endian;
+
+private:
+    RingBuffer (const RingBuffer&);
+    RingBuffer& operator = (const RingBuffer&);
+};
+
+END_NAMESPACE_LIB
+
+#endif //LIB_RING_BUFFER_H
@@ -0,0 +1,445 @@
+#ifndef LIB_RING_QUEUE_H
+#define LIB_RING_QUEUE_H
+
+#include "thread.h"
+#include "atomic.h"
+#include "utils.h"
+
+#include <sched.h>
+
+BEGIN_NAMESPACE_LIB
+
+//////////////////////////////////////////////////////////////////////////
+// Lets threads sleep until a lock-free structure changes, without a mutex.
+// A waiter calls prepareWait, checks its condition again and then either
+// cancelWait or commitWait; notify only costs a system call when somebody
+// is waiting.
+class EventCount
+{
+public:
+    EventCount () : m_seq(0), m_waiters(0) { }
+
+    int  prepareWait ()
+    {
+        atomic_add(&m_waiters, 1);
+        atomic_fence();
+        return atomic_load(&m_seq);
+    }
+
+    void cancelWait  ()     { atomic_add(&m_waiters, -1); }
+
+    // returns false on timeout
+    bool commitWait  (int key, int timeout = -1)
+    {
+        bool woken = Futex::wait(&m_seq, key, timeout);
+        atomic_add(&m_waiters, -1);
+        return woken;
+    }
+
+    void notify      (bool all = false)
+    {
+        atomic_fence();
+
+        if (atomic_load(&m_waiters) > 0)
+        {
+            atomic_add(&m_seq, 1);
+            Futex::wake(&m_seq, all ? Futex::All : 1);
+        }
+    }
+
+protected:
+    volatile int m_seq;
+    volatile int m_waiters;
+};
+
+//////////////////////////////////////////////////////////////////////////
+// Common part of the ring queues: power of two capacity, and push and wait
+// on top of tryPush and tryPop. Blocking queues spin briefly and then sleep
+// on a futex, the others spin and yield, which suits pinned consumers.
+template <class T, class Queue>
+class RingQueueBase
+{
+public:
+    enum { SpinCount = 64 };
+
+    int  capacity   ()  { return (int)m_mask + 1; }
+
+    bool blocking   ()  { return m_blocking; }
+
+    // blocks while the queue is full, throws TimeoutException
+    void push (const T& item, int timeout = -1)
+    {
+        Queue* queue = static_cast<Queue*>(this);
+
+        if (queue->tryPush(item)) return;
+
+        int64 deadline = timeout < 0 ? -1 : tickcount_us() + (int64)timeout * 1000;
+
+        for (int spins = 0; ; ++spins)
+        {
+            if (!m_blocking || spins < SpinCount)
+            {
+                if (!backoff(spins, deadline)) throw TimeoutException("Timeout while ring queue push");
+                if (queue->tryPush(item)) return;
+                continue;
+            }
+
+            int key = m_notFull.prepareWait();
+
+            if (queue->tryPush(item)) { m_notFull.cancelWait(); return; }
+
+            if (!sleep(m_notFull, key, deadline)) throw TimeoutException("Timeout while ring queue push");
+        }
+    }
+
+    // blocks while the queue is empty, throws TimeoutException
+    T wait (int timeout = -1)
+    {
+        Queue* queue = static_cast<Queue*>(this);
+        T item;
+
+        if (queue->tryPop(&item)) return item;
+
+        int64 deadline = timeout < 0 ? -1 : tickcount_us() + (int64)timeout * 1000;
+
+        for (int spins = 0; ; ++spins)
+        {
+            if (!m_blocking || spins < SpinCount)
+            {
+                if (!backoff(spins, deadline)) throw TimeoutException("Timeout while ring queue wait");
+                if (queue->tryPop(&item)) return item;
+                continue;
+            }
+
+            int key = m_notEmpty.prepareWait();
+
+            if (queue->tryPop(&item)) { m_notEmpty.cancelWait(); return item; }
+
+            if (!sleep(m_notEmpty, key, deadline)) throw TimeoutException("Timeout while ring queue wait");
+        }
+    }
+
+protected:
+    RingQueueBase (int capacity, bool blocking) : m_blocking(blocking)
+    {
+        uint size = 2;
+        while ((int)size < capacity) size <<= 1;
+
+        m_mask = size - 1;
+    }
+
+    // returns false when the deadline passed, the wait itself is cancelled then
+    static bool sleep (EventCount& event, int key, int64 deadline)
+    {
+        int timeout = -1;
+
+        if (deadline >= 0)
+        {
+            int64 remain = deadline - tickcount_us();
+            if (remain <= 0) { event.cancelWait(); return false; }
+
+            timeout = (int)((remain + 999) / 1000);
+        }
+
+        event.commitWait(key, timeout);
+        return true;
+    }
+
+    // returns false when the deadline passed
+    static bool backoff (int spins, int64 deadline)
+    {
+        if (deadline >= 0 && tickcount_us() >= deadline) return false;
+
+        if (spins < SpinCount) cpu_relax();
+        else sched_yield();
+
+        return true;
+    }
+
+    void signalPushed   ()  { if (m_blocking) m_notEmpty.notify(); }
+
+    void signalPopped   ()  { if (m_blocking) m_notFull.notify();  }
+
+protected:
+    uint        m_mask;
+    bool        m_blocking;
+    EventCount  m_notEmpty;
+    EventCount  m_notFull;
+};
+
+//////////////////////////////////////////////////////////////////////////
+// Bounded lock-free queue for exactly one producer and one consumer thread.
+// The indices live on their own cache lines and each side caches the index
+// of the other, so the shared lines are only touched when the cached view
+// says full or empty.
+template <class T>
+class SpscQueue : public RingQueueBase<T, SpscQueue<T> >
+{
+    typedef RingQueueBase<T, SpscQueue<T> > Base;
+    using Base::m_mask;
+
+public:
+    // the capacity is rounded up to a power of two
+    SpscQueue (int capacity, bool blocking = false) : Base(capacity, blocking), m_head(0), m_tail(0), m_cachedHead(0), m_cachedTail(0)
+    {
+        m_items = new T[m_mask + 1];
+    }
+
+    ~SpscQueue ()
+    {
+        delete[] m_items;
+    }
+
+    // producer side, returns false when full
+    bool tryPush (const T& item)
+    {
+        uint tail = m_tail;
+
+        if (tail - m_cachedHead > m_mask)
+        {
+            m_cachedHead = atomic_load(&m_head);
+            if (tail - m_cachedHead > m_mask) return false;
+        }
+
+        m_items[tail & m_mask] = item;
+        atomic_store(&m_tail, tail + 1);
+
+        this->signalPushed();
+        return true;
+    }
+
+    // consumer side, returns false when empty
+    bool tryPop (T* item)
+    {
+        uint head = m_head;
+
+        if (head == m_cachedTail)
+        {
+            m_cachedTail = atomic_load(&m_tail);
+            if (head == m_cachedTail) return false;
+        }
+
+        *item = m_items[head & m_mask];
+        atomic_store(&m_head, head + 1);
+
+        this->signalPopped();
+        return true;
+    }
+
+    int  size  ()   { return (int)(atomic_load(&m_tail) - atomic_load(&m_head)); }
+
+    bool empty ()   { return size() == 0; }
+
+protected:
+    char            m_pad0[CacheLineSize];
+    volatile uint   m_head;         // written by the consumer
+    uint            m_cachedTail;
+    char            m_pad1[CacheLineSize];
+    volatile uint   m_tail;         // written by the producer
+    uint            m_cachedHead;
+    char            m_pad2[CacheLineSize];
+    T*              m_items;
+};
+
+//////////////////////////////////////////////////////////////////////////
+// Bounded lock-free queue for any number of producers and consumers, after
+// Dmitry Vyukov. Every cell carries a sequence number telling whether it is
+// ready for the producer or the consumer of the current lap, so both sides
+// only contend on their own position with a single compare and swap.
+template <class T>
+class MpmcQueue : public RingQueueBase<T, MpmcQueue<T> >
+{
+    typedef RingQueueBase<T, MpmcQueue<T> > Base;
+    using Base::m_mask;
+
+public:
+    // the capacity is rounded up to a power of two
+    MpmcQueue (int capacity, bool blocking = false) : Base(capacity, blocking), m_enqueuePos(0), m_dequeuePos(0)
+    {
+        m_cells = new Cell[m_mask + 1];
+
+        for (uint n = 0; n <= m_mask; ++n) m_cells[n].seq = n;
+    }
+
+    ~MpmcQueue ()
+    {
+        delete[] m_cells;
+    }
+
+    // returns false when full
+    bool tryPush (const T& item)
+    {
+        uint pos = atomic_relaxed(&m_enqueuePos);
+        Cell* cell;
+
+        for (;;)
+        {
+            cell = &m_cells[pos & m_mask];
+            int diff = (int)(atomic_load(&cell->seq) - pos);
+
+            if (diff == 0)
+            {
+                if (atomic_cas(&m_enqueuePos, &pos, pos + 1)) break;
+            }
+            else if (diff < 0) return false;
+            else pos = atomic_relaxed(&m_enqueuePos);
+        }
+
+        cell->data = item;
+        atomic_store(&cell->seq, pos + 1);
+
+        this->signalPushed();
+        return true;
+    }
+
+    // returns false when empty
+    bool tryPop (T* item)
+    {
+        uint pos = atomic_relaxed(&m_dequeuePos);
+        Cell* cell;
+
+        for (;;)
+        {
+            cell = &m_cells[pos & m_mask];
+            int diff = (int)(atomic_load(&cell->seq) - (pos + 1));
+
+            if (diff == 0)
+            {
+                if (atomic_cas(&m_dequeuePos, &pos, pos + 1)) break;
+            }
+            else if (diff < 0) return false;
+            else pos = atomic_relaxed(&m_dequeuePos);
+        }
+
+        *item = cell->data;
+        atomic_store(&cell->seq, pos + m_mask + 1);
+
+        this->signalPopped();
+        return true;
+    }
+
+    // approximate while other threads are working on the queue
+    int  size  ()
+    {
+        int count = (int)(atomic_load(&m_enqueuePos) - atomic_load(&m_dequeuePos));
+        return count < 0 ? 0 : count;
+    }
+
+    bool empty ()   { return size() == 0; }
+
+protected:
+    struct Cell
+    {
+        volatile uint   seq;
+        T               data;
+    };
+
+    char            m_pad0[CacheLineSize];
+    volatile uint   m_enqueuePos;
+    char            m_pad1[CacheLineSize];
+    volatile uint   m_dequeuePos;
+    char            m_pad2[CacheLineSize];
+    Cell*           m_cells;
+};
+
+//////////////////////////////////////////////////////////////////////////
+// Bounded work-stealing deque after Chase and Lev. The owner thread pushes
+// and pops at the bottom without contention in the common case, any other
+// thread steals from the top. T has to be a pointer or another plain type.
+template <class T>
+class StealingDeque
+{
+public:
+    // the capacity is rounded up to a power of two
+    StealingDeque (int capacity) : m_top(0), m_bottom(0)
+    {
+        int64 size = 2;
+        while (size < capacity) size <<= 1;
+
+        m_mask  = size - 1;
+        m_items = new T[size];
+    }
+
+    ~StealingDeque ()
+    {
+        delete[] m_items;
+    }
+
+    // owner only, returns false when full
+    bool push (T item)
+    {
+        int64 bottom = atomic_relaxed(&m_bottom);
+        int64 top    = atomic_load(&m_top);
+
+        if (bottom - top > m_mask) return false;
+
+        m_items[bottom & m_mask] = item;
+        atomic_store(&m_bottom, bottom + 1);
+
+        return true;
+    }
+
+    // owner only, takes the most recently pushed item
+    bool pop (T* item)
+    {
+        int64 bottom = atomic_relaxed(&m_bottom) - 1;
+
+        atomic_store(&m_bottom, bottom);
+        atomic_fence();
+
+        int64 top = atomic_load(&m_top);
+
+        if (top > bottom)
+        {
+            atomic_store(&m_bottom, bottom + 1);
+            return false;
+        }
+
+        *item = m_items[bottom & m_mask];
+
+        if (top == bottom)
+        {
+            // the last item, race the thieves for it
+            bool won = atomic_cas(&m_top, &top, top + 1);
+            atomic_store(&m_bottom, bottom + 1);
+            return won;
+        }
+
+        return true;
+    }
+
+    // any thread, takes the oldest item. returns false when empty or another thread won the race
+    bool steal (T* item)
+    {
+        int64 top = atomic_load(&m_top);
+        atomic_fence();
+        int64 bottom = atomic_load(&m_bottom);
+
+        if (top >= bottom) return false;
+
+        *item = m_items[top & m_mask];
+
+        return atomic_cas(&m_top, &top, top + 1);
+    }
+
+    // approximate while other threads are working on the deque
+    int  size  ()
+    {
+        int64 count = atomic_load(&m_bottom) - atomic_load(&m_top);
+        return count < 0 ? 0 : (int)count;
+    }
+
+    bool empty ()   { return size() == 0; }
+
+protected:
+    char            m_pad0[CacheLineSize];
+    volatile int64  m_top;          // advanced by thieves and the owner for the last item
+    char            m_pad1[CacheLineSize];
+    volatile int64  m_bottom;       // written by the owner
+    int64           m_mask;
+    T*              m_items;
+};
+
+END_NAMESPACE_LIB
+
+#endif //LIB_RING_QUEUE_H
@@ -0,0 +1,293 @@
+#include "scan.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define HAVE_SIMD_SCAN
+#include <immintrin.h>
+#endif
+
+BEGIN_NAMESPACE_LIB
+
+// sets up to this size are compared lane by lane, larger ones go through a table
+static const int MaxVectorSet = 16;
+
+// below this length setting up the vectors costs more than it saves
+static const int MinVectorLength = 16;
+
+//////////////////////////////////////////////////////////////////////////
+// the plain loops, also used for the tails of the vector loops
+
+static inline bool in_set (const char* chars, int count, char c)
+{
+    for (int n = 0; n < count; ++n)
+    {
+        if (chars[n] == c) return true;
+    }
+
+    return false;
+}
+
+static const char* scalar_find_any (const char* p, const char* end, const char* chars, int count, bool match)
+{
+    if (end - p < 64 || count <= 4)
+    {
+        for (; p < end; ++p)
+        {
+            if (in_set(chars, count, *p) == match) return p;
+        }
+
+        return end;
+    }
+
+    bool table[256] = { false };
+    for (int n = 0; n < count; ++n) table[(byte)chars[n]] = true;
+
+    for (; p < end; ++p)
+    {
+        if (table[(byte)*p] == match) return p;
+    }
+
+    return end;
+}
+
+static const char* scalar_search (const char* p, const char* end, const char* needle, int length)
+{
+    const char* last = end - length;
+
+    while (p <= last)
+    {
+        p = (const char*)memchr(p, needle[0], last - p + 1);
+        if (p == 0) break;
+
+        if (memcmp(p + 1, needle + 1, length - 1) == 0) return p;
+        p++;
+    }
+
+    return end;
+}
+
+#ifdef HAVE_SIMD_SCAN
+
+//////////////////////////////////////////////////////////////////////////
+// SSE2, part of every x86-64
+
+static const char* sse2_find_any (const char* p, const char* end, const char* chars, int count, bool match)
+{
+    __m128i set[MaxVectorSet];
+    for (int n = 0; n < count; ++n) set[n] = _mm_set1_epi8(chars[n]);
+
+    for (; end - p >= 16; p += 16)
+    {
+        __m128i data = _mm_loadu_si128((const __m128i*)p);
+        __m128i hits = _mm_cmpeq_epi8(data, set[0]);
+
+        for (int n = 1; n < count; ++n) hits = _mm_or_si128(hits, _mm_cmpeq_epi8(data, set[n]));
+
+        uint mask = (uint)_mm_movemask_epi8(hits);
+        if (!match) mask ^= 0xFFFF;
+
+        if (mask) return p + __builtin_ctz(mask);
+    }
+
+    return scalar_find_any(p, end, chars, count, match);
+}
+
+static const char* sse2_search (const char* p, const char* end, const char* needle, int length)
+{
+    // candidates match the first and the last byte, only they are compared in full
+    __m128i first = _mm_set1_epi8(needle[0]);
+    __m128i last  = _mm_set1_epi8(needle[length - 1]);
+
+    for (; end - p >= length - 1 + 16; p += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)p);
+        __m128i b = _mm_loadu_si128((const __m128i*)(p + length - 1));
+
+        uint mask = (uint)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+
+        while (mask)
+        {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(p + bit + 1, needle + 1, length - 2) == 0) return p + bit;
+
+            mask &= mask - 1;
+        }
+    }
+
+    return scalar_search(p, end, needle, length);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// AVX2, compiled for the target here and only called when the CPU has it
+
+// ASCII sets of any size through two nibble lookups: the low nibble of a byte selects
+// the set of high nibbles it is a member with, the high nibble the bit to test
+__attribute__((target("avx2")))
+static const char* avx2_find_ascii (const char* p, const char* end, const char* chars, int count, bool match)
+{
+    char rows[16] = { 0 };
+    for (int n = 0; n < count; ++n) rows[chars[n] & 0x0F] |= (char)(1 << (chars[n] >> 4));
+
+    __m128i row128 = _mm_loadu_si128((const __m128i*)rows);
+    __m256i table  = _mm256_broadcastsi128_si256(row128);
+
+    // bytes from 0x80 select zero
+    __m256i bits   = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0,
+                                      1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0);
+    __m256i nibble = _mm256_set1_epi8(0x0F);
+    __m256i zero   = _mm256_setzero_si256();
+
+    for (; end - p >= 32; p += 32)
+    {
+        __m256i data = _mm256_loadu_si256((const __m256i*)p);
+        __m256i row  = _mm256_shuffle_epi8(table, _mm256_and_si256(data, nibble));
+        __m256i bit  = _mm256_shuffle_epi8(bits, _mm256_and_si256(_mm256_srli_epi16(data, 4), nibble));
+
+        // the mask has the bytes outside the set
+        uint mask = (uint)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(row, bit), zero));
+        if (match) mask = ~mask;
+
+        if (mask) return p + __builtin_ctz(mask);
+    }
+
+    return scalar_find_any(p, end, chars, count, match);
+}
+
+__attribute__((target("avx2")))
+static const char* avx2_find_any (const char* p, const char* end, const char* chars, int count, bool match)
+{
+    bool ascii = true;
+    for (int n = 0; n < count; ++n) ascii = ascii && (byte)chars[n] < 0x80;
+
+    if (ascii) return avx2_find_ascii(p, end, chars, count, match);
+
+    __m256i set[MaxVectorSet];
+    for (int n = 0; n < count; ++n) set[n] = _mm256_set1_epi8(chars[n]);
+
+    for (; end - p >= 32; p += 32)
+    {
+        __m256i data = _mm256_loadu_si256((const __m256i*)p);
+        __m256i hits = _mm256_cmpeq_epi8(data, set[0]);
+
+        for (int n = 1; n < count; ++n) hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(data, set[n]));
+
+        uint mask = (uint)_mm256_movemask_epi8(hits);
+        if (!match) mask = ~mask;
+
+        if (mask) return p + __builtin_ctz(mask);
+    }
+
+    return sse2_find_any(p, end, chars, count, match);
+}
+
+__attribute__((target("avx2")))
+static const char* avx2_search (const char* p, const char* end, const char* needle, int length)
+{
+    __m256i first = _mm256_set1_epi8(needle[0]);
+    __m256i last  = _mm256_set1_epi8(needle[length - 1]);
+
+    for (; end - p >= length - 1 + 32; p += 32)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i*)p);
+        __m256i b = _mm256_loadu_si256((const __m256i*)(p + length - 1));
+
+        uint mask = (uint)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+
+        while (mask)
+        {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(p + bit + 1, needle + 1, length - 2) == 0) return p + bit;
+
+            mask &= mask - 1;
+        }
+    }
+
+    return sse2_search(p, end, needle, length);
+}
+
+static Scan::Level detect_level ()
+{
+    __builtin_cpu_init();
+
+    return __builtin_cpu_supports("avx2") ? Scan::AVX2 : Scan::SSE2;
+}
+
+#else
+
+static Scan::Level detect_level ()
+{
+    return Scan::Scalar;
+}
+
+#endif // HAVE_SIMD_SCAN
+
+static const Scan::Level s_detected = detect_level();
+
+static Scan::Level s_level = s_detected;
+
+//////////////////////////////////////////////////////////////////////////
+const char* Scan::find (const char* begin, const char* end, char ch)
+{
+    // the memchr of the C library is vectorized and dispatched at runtime already
+    const char* p = begin < end ? (const char*)memchr(begin, ch, end - begin) : 0;
+
+    return p ? p : end;
+}
+
+const char* Scan::findAny (const char* begin, const char* end, const char* chars, int count)
+{
+    if (count <= 0) return end;
+    if (count == 1) return find(begin, end, chars[0]);
+
+#ifdef HAVE_SIMD_SCAN
+    if (count <= MaxVectorSet && end - begin >= MinVectorLength)
+    {
+        if (s_level == AVX2) return avx2_find_any(begin, end, chars, count, true);
+        if (s_level == SSE2) return sse2_find_any(begin, end, chars, count, true);
+    }
+#endif
+
+    return scalar_find_any(begin, end, chars, count, true);
+}
+
+const char* Scan::skipAny (const char* begin, const char* end, const char* chars, int count)
+{
+    if (count <= 0) return begin;
+
+#ifdef HAVE_SIMD_SCAN
+    if (count <= MaxVectorSet && end - begin >= MinVectorLength)
+    {
+        if (s_level == AVX2) return avx2_find_any(begin, end, chars, count, false);
+        if (s_level == SSE2) return sse2_find_any(begin, end, chars, count, false);
+    }
+#endif
+
+    return scalar_find_any(begin, end, chars, count, false);
+}
+
+const char* Scan::search (const char* begin, const char* end, const char* needle, int length)
+{
+    if (length <= 0) return begin;
+    if (length == 1) return find(begin, end, needle[0]);
+    if (end - begin < length) return end;
+
+#ifdef HAVE_SIMD_SCAN
+    if (s_level == AVX2) return avx2_search(begin, end, needle, length);
+    if (s_level == SSE2) return sse2_search(begin, end, needle, length);
+#endif
+
+    return scalar_search(begin, end, needle, length);
+}
+
+Scan::Level Scan::level ()
+{
+    return s_level;
+}
+
+void Scan::setLevel (Level level)
+{
+    s_level = level < s_detected ? level : s_detected;
+}
+
+END_NAMESPACE_LIB
@@ -0,0 +1,37 @@
+#ifndef LIB_SCAN_H
+#define LIB_SCAN_H
+
+#include "types.h"
+
+BEGIN_NAMESPACE_LIB
+
+//////////////////////////////////////////////////////////////////////////
+// Byte searches over [begin, end) for the buffers and readers, 16 or 32
+// bytes per step. The implementation is picked once at startup: AVX2 when
+// the CPU has it, SSE2 on any x86-64, plain loops elsewhere. Each search
+// returns the position found, or end.
+struct Scan
+{
+    enum Level { Scalar, SSE2, AVX2 };
+
+    // the first ch
+    static const char*  find        (const char* begin, const char* end, char ch);
+
+    // the first byte which is one of count chars
+    static const char*  findAny     (const char* begin, const char* end, const char* chars, int count);
+
+    // the first byte which is none of them
+    static const char*  skipAny     (const char* begin, const char* end, const char* chars, int count);
+
+    // the first occurrence of the needle, which has to lie within the range completely
+    static const char*  search      (const char* begin, const char* end, const char* needle, int length);
+
+    static Level        level       ();
+
+    // caps the level at what the CPU has, to compare the implementations
+    static void         setLevel    (Level level);
+};
+
+END_NAMESPACE_LIB
+
+#endif //LIB_SCAN_H
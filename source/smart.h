@@ -2,6 +2,7 @@
 #define LIB_SMART_H
 
 #include "types.h"
+#include "atomic.h"
 
 BEGIN_NAMESPACE_LIB
 
@@ -10,14 +11,15 @@ class RefCounted
 public:
     int addRef ()
     {
-        int count = ++m_refCount;
+        int count = atomic_add(&m_refCount, 1);
         //logmsg("RefCounted: 0x%x, ref = %d\n", this, count);
         return count;
     }
 
     int release ()
     {
-        int count = --m_refCount;
+        // atomic, so the last reference may be dropped on any thread
+        int count = atomic_add(&m_refCount, -1);
         if (count == 0) delete this;
 
         //logmsg("RefCounted: 0x%x, ref = %d\n", this, count);
@@ -29,7 +31,7 @@ protected:
     virtual ~RefCounted() { };
 
 private:
-    int m_refCount;
+    volatile int m_refCount;
 };
 
 //////////////////////////////////////////////////////////////////////////
@@ -1,4 +1,5 @@
 #include "socket.h"
+#include "connector.h"
 #include "errors.h"
 #include "utils.h"
 
@@ -44,6 +45,8 @@ void socket_init()
 }
 #else // for linux
 #include <errno.h>
+#include <limits.h>
+#include <net/if.h>
 
 #define socket_ioctl ::ioctl
 #define socket_close ::close
@@ -66,54 +69,163 @@ int socket_set_blocking(socket_t sock, bool value)
 //////////////////////////////////////////////////////////////////////////
 BEGIN_NAMESPACE_LIB
 
+static const byte IPv6AnyBytes[16]      = { 0 };
+static const byte IPv6LoopbackBytes[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 };
+static const byte IPv4MappedPrefix[12]  = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF };
+
 IpAddress IpAddress::Any = IpAddress((uint)0);  // 0.0.0.0
 
 IpAddress IpAddress::None = IpAddress(0xFFFFFFFF); // 255.255.255.255
 
 IpAddress IpAddress::Loopback = IpAddress(0x7F000001); // 127.0.0.1
 
-IpAddress::IpAddress (uint address)
+IpAddress IpAddress::IPv6Any = IpAddress(IPv6AnyBytes, 16); // ::
+
+IpAddress IpAddress::IPv6Loopback = IpAddress(IPv6LoopbackBytes, 16); // ::1
+
+// strict dotted decimal, the result is in network byte order
+static bool parse_ipv4 (const char* str, uint* result)
 {
-    m_address = htonl(address);
+    uint value = 0;
+
+    for (int n = 0; n < 4; ++n)
+    {
+        if (*str < '0' || *str > '9') return false;
+
+        uint part = 0; int digits = 0;
+
+        while (*str >= '0' && *str <= '9')
+        {
+            part = part * 10 + (*str++ - '0');
+            if (++digits > 3) return false;
+        }
+
+        if (part > 255) return false;
+        value = (value << 8) | part;
+
+        if (n < 3 && *str++ != '.') return false;
+    }
+
+    if (*str) return false;
+
+    *result = htonl(value);
+    return true;
 }
 
-IpAddress::IpAddress (byte address[], int count)
+static int format_ipv4 (const byte* addr, char* p)
 {
-    if (count != 4) throw InvalidArgumentException();
-    m_address = ((((address[3] << 0x18) | (address[2] << 0x10)) | (address[1] << 8)) | address[0]);
+    char* start = p;
+
+    for (int n = 0; n < 4; ++n)
+    {
+        uint v = addr[n];
+
+        if (v >= 100) { *p++ = '0' + v / 100; v %= 100; *p++ = '0' + v / 10; v %= 10; }
+        else if (v >= 10) { *p++ = '0' + v / 10; v %= 10; }
+
+        *p++ = '0' + v;
+
+        if (n < 3) *p++ = '.';
+    }
+
+    *p = 0;
+    return p - start;
+}
+
+IpAddress::IpAddress (uint address) : m_scope(0), m_family(AF_INET)
+{
+    memset(&m_address, 0, sizeof(m_address));
+    m_address.v4 = htonl(address);
+}
+
+IpAddress::IpAddress (const byte address[], int count) : m_scope(0)
+{
+    if (count != 4 && count != 16) throw InvalidArgumentException();
+
+    memset(&m_address, 0, sizeof(m_address));
+    memcpy(m_address.v6, address, count);
+
+    m_family = (count == 4) ? AF_INET : AF_INET6;
 }
 
 IpAddress::IpAddress (const char* address)
 {
-    m_address = inet_addr(address);
+    if (!tryParse(address, this)) *this = None;
 }
 
 IpAddress::IpAddress (const string& address)
 {
-    m_address = inet_addr(address.c_str());
+    if (!tryParse(address.c_str(), this)) *this = None;
 }
 
-IpAddress::IpAddress (const SocketAddress& address)
+IpAddress::IpAddress (const SocketAddress& address) : m_scope(0)
 {
-    sockaddr_in* addr = (sockaddr_in*)address.m_data;
-    m_address = addr->sin_addr.s_addr;
+    memset(&m_address, 0, sizeof(m_address));
+
+    if (address.family() == AF_INET6)
+    {
+        memcpy(m_address.v6, &address.m_data.v6.sin6_addr, 16);
+        m_scope  = address.m_data.v6.sin6_scope_id;
+        m_family = AF_INET6;
+    }
+    else
+    {
+        m_address.v4 = address.m_data.v4.sin_addr.s_addr;
+        m_family = AF_INET;
+    }
+}
+
+bool IpAddress::isV4Mapped () const
+{
+    return isV6() && memcmp(m_address.v6, IPv4MappedPrefix, sizeof(IPv4MappedPrefix)) == 0;
+}
+
+IpAddress IpAddress::toV6 () const
+{
+    if (isV6()) return *this;
+
+    byte mapped[16];
+    memcpy(mapped, IPv4MappedPrefix, 12);
+    memcpy(mapped + 12, m_address.v6, 4);
+
+    return IpAddress(mapped, 16);
+}
+
+IpAddress IpAddress::toV4 () const
+{
+    return isV4Mapped() ? IpAddress(m_address.v6 + 12, 4) : *this;
+}
+
+int IpAddress::format (char* buffer, int size) const
+{
+    if (size < MaxStringLength) throw InvalidArgumentException("Buffer is too small for an ip address");
+
+    if (isV4()) return format_ipv4(m_address.v6, buffer);
+
+    if (!inet_ntop(AF_INET6, m_address.v6, buffer, size)) throw FormatException("Invalid ip address");
+
+    int len = strlen(buffer);
+    if (m_scope) len += snprintf(buffer + len, size - len, "%%%u", m_scope);
+
+    return len;
 }
 
 string IpAddress::toString () const
 {
-    byte* addr = (byte*)&m_address;
-    string value = format("%d.%d.%d.%d", addr[0], addr[1], addr[2], addr[3]);
-    return value;
+    char buffer[MaxStringLength];
+    int len = format(buffer, sizeof(buffer));
+
+    return string(buffer, len);
 }
 
 bool IpAddress::operator == (const IpAddress& other) const
 {
-    return (m_address == other.m_address);
+    return m_family == other.m_family && m_scope == other.m_scope && memcmp(m_address.v6, other.m_address.v6, size()) == 0;
 }
 
 bool IpAddress::operator != (const IpAddress& other) const
 {
-    return (m_address != other.m_address);
+    return !operator == (other);
 }
 
 IpAddress IpAddress::parse (const char* ipstr)
@@ -126,32 +238,97 @@ IpAddress IpAddress::parse(const string& ipstr)
     return IpAddress(ipstr);
 }
 
+bool IpAddress::tryParse (const char* ipstr, IpAddress* result)
+{
+    IpAddress value;
+
+    if (ipstr == 0) return false;
+
+    if (parse_ipv4(ipstr, &value.m_address.v4))
+    {
+        *result = value;
+        return true;
+    }
+
+    if (strchr(ipstr, ':') == 0) return false;
+
+    // split an optional %scope suffix of link local addresses
+    char text[MaxStringLength];
+    const char* scope = strchr(ipstr, '%');
+    int len = scope ? scope - ipstr : strlen(ipstr);
+
+    if (len >= MaxStringLength) return false;
+
+    memcpy(text, ipstr, len);
+    text[len] = 0;
+
+    if (inet_pton(AF_INET6, text, value.m_address.v6) != 1) return false;
+
+    value.m_family = AF_INET6;
+
+    if (scope)
+    {
+        value.m_scope = atoi(scope + 1);
+        #ifndef WIN32
+        if (value.m_scope == 0) value.m_scope = if_nametoindex(scope + 1);
+        #endif
+    }
+
+    *result = value;
+    return true;
+}
+
 //////////////////////////////////////////////////////////////////////////
 SocketAddress::SocketAddress(const IpAddress& address, int port)
 {
-    sockaddr_in* addr = (sockaddr_in*)&m_data;
-    memset(addr, 0, sizeof(sockaddr_in));
+    memset(&m_data, 0, sizeof(m_data));
 
-    addr->sin_family = AF_INET;
-    addr->sin_addr.s_addr = address.m_address;
-    addr->sin_port = htons(port);
+    if (address.isV6())
+    {
+        m_data.v6.sin6_family   = AF_INET6;
+        m_data.v6.sin6_port     = htons(port);
+        m_data.v6.sin6_scope_id = address.m_scope;
+        memcpy(&m_data.v6.sin6_addr, address.m_address.v6, 16);
+    }
+    else
+    {
+        m_data.v4.sin_family      = AF_INET;
+        m_data.v4.sin_port        = htons(port);
+        m_data.v4.sin_addr.s_addr = address.m_address.v4;
+    }
 }
 
-
 SocketAddress::SocketAddress()
 {
-    memset(m_data, 0, sizeof(m_data));
+    memset(&m_data, 0, sizeof(m_data));
 }
 
-IpAddress SocketAddress::ipAddress ()
+IpAddress SocketAddress::ipAddress () const
 {
     return IpAddress(*this);
 }
 
-int SocketAddress::port ()
+int SocketAddress::port () const
 {
-    sockaddr_in* addr = (sockaddr_in*)&m_data;
-    return htons(addr->sin_port);
+    return ntohs(family() == AF_INET6 ? m_data.v6.sin6_port : m_data.v4.sin_port);
+}
+
+string SocketAddress::toString () const
+{
+    char buffer[IpAddress::MaxStringLength + 16];
+    IpAddress address(*this);
+
+    int len = 0;
+
+    if (address.isV6()) buffer[len++] = '[';
+
+    len += address.format(buffer + len, IpAddress::MaxStringLength);
+
+    if (address.isV6()) buffer[len++] = ']';
+
+    len += snprintf(buffer + len, sizeof(buffer) - len, ":%d", port());
+
+    return string(buffer, len);
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -178,13 +355,20 @@ Socket::~Socket ()
     close();
 }
 
+SocketAddress Socket::endPoint (const IpAddress& address, int port)
+{
+    if (m_family == InterNetworkV6 && address.isV4()) return SocketAddress(address.toV6(), port);
+
+    return SocketAddress(address, port);
+}
+
 void Socket::connect (const IpAddress& host, int port, int timeout)
 {
-    SocketAddress addr(host, port);
+    SocketAddress addr = endPoint(host, port);
        
     if (timeout > 0) socket_set_blocking(m_socket, false);
 
-    int err = ::connect(m_socket, (sockaddr*)&addr.m_data, sizeof(sockaddr));
+    int err = ::connect(m_socket, &addr.m_data.base, addr.size());
     if (err < 0) err = socket_error();
 
     if (timeout > 0) socket_set_blocking(m_socket, m_blocking);
@@ -202,11 +386,47 @@ void Socket::connect (const IpAddress& host, int port, int timeout)
     m_connected = true;
 }
 
+bool Socket::beginConnect (const IpAddress& host, int port)
+{
+    SocketAddress addr = endPoint(host, port);
+
+    int err = ::connect(m_socket, &addr.m_data.base, addr.size());
+
+    if (err == 0)
+    {
+        m_connected = true;
+        return true;
+    }
+
+    err = socket_error();
+    if (is_in_progress(err) || is_would_block(err) || is_interrupted(err)) return false;
+
+    throw SocketException();
+}
+
+void Socket::endConnect ()
+{
+    int err = solError();
+
+    if (err)
+    {
+        // reported by Socket::error() like other socket failures
+#ifdef WIN32
+        WSASetLastError(err);
+#else
+        errno = err;
+#endif
+        throw SocketException();
+    }
+
+    m_connected = true;
+}
+
 void Socket::bind (const IpAddress& address, int port)
 {
-    SocketAddress addr(address, port);
+    SocketAddress addr = endPoint(address, port);
 
-    int err = ::bind(m_socket, (sockaddr*)&addr.m_data, sizeof(sockaddr));
+    int err = ::bind(m_socket, &addr.m_data.base, addr.size());
     if (err) throw SocketException();
 }
 
@@ -216,21 +436,28 @@ void Socket::listen (int backlog)
     if (err) throw SocketException();
 }
 
-Socket* Socket::accept ()
+Socket* Socket::accept (bool blocking)
 {
     for (;;)
     {
+#ifdef WIN32
         socket_t sock = ::accept(m_socket, NULL, NULL);
+        if (sock != InvalidSocket && !blocking) socket_set_blocking(sock, false);
+#else
+        int flags = SOCK_CLOEXEC | (blocking ? 0 : SOCK_NONBLOCK);
+        socket_t sock = ::accept4(m_socket, NULL, NULL, flags);
+#endif
 
         if (sock < 0)
         {
             int err = socket_error();
             if (is_interrupted(err)) continue;
+            if (is_would_block(err)) return 0;
 
             throw SocketException();
         }
 
-        return new Socket(sock, m_family, TCP, false, true);
+        return new Socket(sock, m_family, TCP, blocking, true);
     }    
 }
 
@@ -280,14 +507,42 @@ int Socket::send (const void* data, int offset, int size, int flags)
     }
 }
 
+int Socket::send (const iovec* vec, int count, int flags)
+{
+    flags |= MSG_NOSIGNAL; // do not generate SIGPIPE.
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+
+    msg.msg_iov    = (iovec*)vec;
+    msg.msg_iovlen = min(count, IOV_MAX);
+
+    for (;;)
+    {
+        int num = ::sendmsg(m_socket, &msg, flags);
+
+        if (num < 0)
+        {
+            int err = socket_error();
+
+            if (is_interrupted(err)) continue;
+            if (is_would_block(err)) return WouldBlock;
+            
+            throw SocketException();
+        }
+
+        return num;
+    }
+}
+
 int Socket::sendTo (const void* data, int offset, int size, const IpAddress& host, int port, int flags)
 {
-    SocketAddress addr(host, port);
+    SocketAddress addr = endPoint(host, port);
     socklen_t length = addr.size();
 
     for (;;)
     {
-        int num = ::sendto(m_socket, (const char*)data + offset, size, flags, (sockaddr*)&addr.m_data, length);
+        int num = ::sendto(m_socket, (const char*)data + offset, size, flags, &addr.m_data.base, length);
     
         if (num < 0)
         {
@@ -326,11 +581,11 @@ int Socket::receive (void* data, int offset, int size, int flags)
 int Socket::receiveFrom (void* data, int offset, int size, IpAddress* host, int* port, int flags)
 {
     SocketAddress addr;
-    socklen_t length = addr.size();
+    socklen_t length = sizeof(addr.m_data);
 
     for (;;)
     {
-        int num = recvfrom(m_socket, (char*)data + offset, size, flags, (sockaddr*)&addr.m_data, &length);
+        int num = recvfrom(m_socket, (char*)data + offset, size, flags, &addr.m_data.base, &length);
     
         if (num < 0)
         {
@@ -402,48 +657,64 @@ int Socket::available ()
     return (int)size;
 }
 
+bool Socket::dualMode ()
+{
+    return getOption(IPPROTO_IPV6, IPV6_V6ONLY) == 0;
+}
+
+void Socket::setDualMode (bool value)
+{
+    setOption(IPPROTO_IPV6, IPV6_V6ONLY, value ? 0 : 1);
+}
+
+SocketAddress Socket::localEndPoint ()
+{
+    SocketAddress addr;
+    socklen_t length = sizeof(addr.m_data);
+
+    if (getsockname(m_socket, &addr.m_data.base, &length) < 0) throw SocketException();
+
+    return addr;
+}
+
+SocketAddress Socket::remoteEndPoint ()
+{
+    SocketAddress addr;
+    socklen_t length = sizeof(addr.m_data);
+
+    if (getpeername(m_socket, &addr.m_data.base, &length) < 0) throw SocketException();
+
+    return addr;
+}
+
 IpAddress Socket::localAddress ()
 {
-    SocketAddress addr(IpAddress::Any, 0);
-    int length = sizeof(addr.m_data);
-    getsockname(m_socket, (sockaddr*)&addr, (socklen_t*)&length);
-    return IpAddress(addr);
+    return localEndPoint().ipAddress();
 }
 
 IpAddress Socket::remoteAddress ()
 {
-    SocketAddress addr(IpAddress::Any, 0);
-    int length = sizeof(addr.m_data);
-    getpeername(m_socket, (sockaddr*)addr.m_data, (socklen_t*)&length);
-    return IpAddress(addr);
+    return remoteEndPoint().ipAddress();
 }
 
 int Socket::localPort ()
 {
-    SocketAddress addr(IpAddress::Any, 0);
-    int length = sizeof(addr.m_data);
-    getsockname(m_socket, (sockaddr*)addr.m_data, (socklen_t*)&length);
-    return addr.port();
+    return localEndPoint().port();
 }
 
 int Socket::remotePort ()
 {
-    SocketAddress addr(IpAddress::Any, 0);
-    int length = sizeof(addr.m_data);
-    getpeername(m_socket, (sockaddr*)addr.m_data, (socklen_t*)&length);
-    return addr.port();
+    return remoteEndPoint().port();
 }
 
 string Socket::remoteName()
 {
-    string ip = remoteAddress().toString();
-    return format("%s:%d", ip.c_str(), remotePort());
+    return remoteEndPoint().toString();
 }
 
 string Socket::localName()
 {
-    string ip = localAddress().toString();
-    return format("%s:%d", ip.c_str(), localPort());
+    return localEndPoint().toString();
 }
 
 void Socket::setOption (int level, int name, const void* value, int length)
@@ -542,6 +813,16 @@ void Socket::setReuseAddress (bool value)
     setOption(SOL_SOCKET, SO_REUSEADDR, value ? 1 : 0);
 }
 
+bool Socket::reusePort ()
+{
+    return getOption(SOL_SOCKET, SO_REUSEPORT) != 0;
+}
+
+void Socket::setReusePort (bool value)
+{
+    setOption(SOL_SOCKET, SO_REUSEPORT, value ? 1 : 0);
+}
+
 bool Socket::tcpNoDelay ()
 {
     return getOption(IPPROTO_TCP, TCP_NODELAY) != 0;
@@ -576,6 +857,146 @@ void Socket::setKeepAlive (bool onoff, int idle, int interval, int count)
 #endif
 }
 
+//////////////////////////////////////////////////////////////////////////
+#ifndef WIN32
+int UdpSocket::receiveBatch (Buffer* buffers[], int count, SocketAddress* sources, int64* timestamps, int flags)
+{
+    if (count > MaxBatch) count = MaxBatch;
+    if (count <= 0) return 0;
+
+    enum { ControlSize = CMSG_SPACE(sizeof(timespec)) };
+
+    mmsghdr msgs[MaxBatch];
+    iovec   iovs[MaxBatch];
+    char    controls[MaxBatch][ControlSize];
+
+    memset(msgs, 0, sizeof(mmsghdr) * count);
+
+    for (int n = 0; n < count; ++n)
+    {
+        iovs[n].iov_base = buffers[n]->end();
+        iovs[n].iov_len  = buffers[n]->freeSpace();
+
+        msghdr& hdr = msgs[n].msg_hdr;
+        hdr.msg_iov    = &iovs[n];
+        hdr.msg_iovlen = 1;
+
+        if (sources)
+        {
+            hdr.msg_name    = &sources[n].m_data;
+            hdr.msg_namelen = sizeof(sources[n].m_data);
+        }
+
+        if (timestamps)
+        {
+            hdr.msg_control    = controls[n];
+            hdr.msg_controllen = ControlSize;
+        }
+    }
+
+    // a blocking socket would otherwise wait until all the count datagrams arrive
+    if (m_blocking) flags |= MSG_WAITFORONE;
+
+    int num = 0;
+
+    for (;;)
+    {
+        num = recvmmsg(m_socket, msgs, count, flags, 0);
+
+        if (num < 0)
+        {
+            int err = socket_error();
+
+            if (is_interrupted(err)) continue;
+            if (is_would_block(err)) return WouldBlock;
+
+            throw SocketException();
+        }
+
+        break;
+    }
+
+    for (int n = 0; n < num; ++n)
+    {
+        buffers[n]->extendLen(msgs[n].msg_len);
+
+        if (timestamps)
+        {
+            msghdr& hdr = msgs[n].msg_hdr;
+            timestamps[n] = 0;
+
+            for (cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg))
+            {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+                {
+                    timespec ts;
+                    memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                    timestamps[n] = (int64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+                }
+            }
+        }
+    }
+
+    return num;
+}
+
+int UdpSocket::sendBatch (Buffer* buffers[], int count, const SocketAddress* targets, int flags)
+{
+    if (count > MaxBatch) count = MaxBatch;
+    if (count <= 0) return 0;
+
+    mmsghdr msgs[MaxBatch];
+    iovec   iovs[MaxBatch];
+
+    memset(msgs, 0, sizeof(mmsghdr) * count);
+
+    for (int n = 0; n < count; ++n)
+    {
+        iovs[n].iov_base = buffers[n]->current();
+        iovs[n].iov_len  = buffers[n]->remaining();
+
+        msghdr& hdr = msgs[n].msg_hdr;
+        hdr.msg_iov    = &iovs[n];
+        hdr.msg_iovlen = 1;
+
+        if (targets)
+        {
+            hdr.msg_name    = (void*)&targets[n].m_data;
+            hdr.msg_namelen = targets[n].size();
+        }
+    }
+
+    flags |= MSG_NOSIGNAL;
+
+    for (;;)
+    {
+        int num = sendmmsg(m_socket, msgs, count, flags);
+
+        if (num < 0)
+        {
+            int err = socket_error();
+
+            if (is_interrupted(err)) continue;
+            if (is_would_block(err)) return WouldBlock;
+
+            throw SocketException();
+        }
+
+        return num;
+    }
+}
+
+bool UdpSocket::timestamping ()
+{
+    return getOption(SOL_SOCKET, SO_TIMESTAMPNS) != 0;
+}
+
+void UdpSocket::setTimestamping (bool value)
+{
+    setOption(SOL_SOCKET, SO_TIMESTAMPNS, value ? 1 : 0);
+}
+#endif
+
 /////////////////////////////////////////////////////////////////////////////////////////////////
 NetworkStream::NetworkStream (Socket* socket, bool own)
   : m_socket(socket), m_ownSocket(own), m_sendTimeout(-1), m_recvTimeout(-1)
@@ -585,7 +1006,7 @@ NetworkStream::NetworkStream (Socket* socket, bool own)
 NetworkStream::NetworkStream (const IpAddress& host, int port, int connTimeout)
   : m_socket(0), m_ownSocket(true), m_sendTimeout(-1), m_recvTimeout(-1)
 {
-    m_socket = new Socket();
+    m_socket = new Socket((Socket::AddressFamily)host.family());
 
     try
     {
@@ -598,11 +1019,29 @@ NetworkStream::NetworkStream (const IpAddress& host, int port, int connTimeout)
     }
 }
 
+NetworkStream::NetworkStream (const char* host, int port, int connTimeout)
+  : m_socket(0), m_sendTimeout(-1), m_recvTimeout(-1), m_ownSocket(true)
+{
+    m_socket = connect(host, port, connTimeout);
+}
+
+NetworkStream::NetworkStream (const string& host, int port, int connTimeout)
+  : m_socket(0), m_sendTimeout(-1), m_recvTimeout(-1), m_ownSocket(true)
+{
+    m_socket = connect(host, port, connTimeout);
+}
+
 NetworkStream::~NetworkStream ()
 {
     close();
 }
 
+Socket* NetworkStream::connect (const string& host, int port, int connTimeout)
+{
+    Connector connector;
+    return connector.connect(host, port, connTimeout);
+}
+
 bool NetworkStream::canRead ()
 {
     return true;
@@ -683,6 +1122,21 @@ int NetworkStream::write (const void* data, int offset, int size)
     return num;
 }
 
+int NetworkStream::writev (const iovec* vec, int count)
+{
+    if (count <= 0) return 0;
+
+    if (m_sendTimeout >= 0 && !m_socket->poll(m_sendTimeout, Socket::SelectWrite))
+    {
+        throw TimeoutException("Timeout while write network stream");
+    }
+
+    int num = m_socket->send(vec, count);
+    if (num < 0) throw SocketException();
+
+    return num;
+}
+
 void NetworkStream::flush ()
 {
 }
@@ -2,15 +2,18 @@
 #define LIB_SOCKET_H
 
 #include "stream.h"
+#include "buffer.h"
 
 #ifdef _WIN32
 #define _WIN32_WINNT 0x0600
 #include <WinSock2.h>
+#include <WS2tcpip.h>
 typedef SOCKET socket_t;
 #else
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
 #include <sys/ioctl.h>
 #include <sys/unistd.h>
 #include <netinet/tcp.h>
@@ -29,24 +32,60 @@ public:
     static IpAddress Any;
     static IpAddress Loopback;
     static IpAddress None;
+    static IpAddress IPv6Any;
+    static IpAddress IPv6Loopback;
+
+    enum { MaxStringLength = 64 }; // enough for an IPv6 address with a scope
 
 public:
-    IpAddress (uint address = 0);
-    IpAddress (byte address[], int count);
+    IpAddress (uint address = 0);                   // IPv4 in host byte order
+    IpAddress (const byte address[], int count);    // 4 or 16 bytes in network byte order
     IpAddress (const char* address);
     IpAddress (const string& address);
     IpAddress (const SocketAddress& address);
 
-    string toString () const;
+    int         family      () const    { return m_family; }
+
+    bool        isV4        () const    { return m_family == AF_INET;  }
+
+    bool        isV6        () const    { return m_family == AF_INET6; }
+
+    bool        isV4Mapped  () const;
+
+    const byte* bytes       () const    { return m_address.v6; }
+
+    int         size        () const    { return isV6() ? 16 : 4; }
+
+    uint        scopeId     () const    { return m_scope; }
+
+    // the IPv4-mapped IPv6 form used to reach IPv4 peers from dual-stack sockets
+    IpAddress   toV6        () const;
+
+    // the IPv4 address of an IPv4-mapped IPv6 address, otherwise the address itself
+    IpAddress   toV4        () const;
+
+    string      toString    () const;
+
+    // formats into the buffer without allocation, returns the length written
+    int         format      (char* buffer, int size) const;
 
     bool operator == (const IpAddress& other) const;
     bool operator != (const IpAddress& other) const;
 
-    static IpAddress parse  (const char* ipstr);
-    static IpAddress parse  (const string& ipstr);
+    static IpAddress parse      (const char* ipstr);
+    static IpAddress parse      (const string& ipstr);
+
+    static bool      tryParse   (const char* ipstr, IpAddress* result);
 
 private:
-    uint m_address;
+    union
+    {
+        uint v4;
+        byte v6[16];
+    } m_address;
+
+    uint    m_scope;
+    ushort  m_family;
 
     friend class Socket;
     friend class SocketAddress;
@@ -59,16 +98,28 @@ public:
     SocketAddress();
     SocketAddress(const IpAddress& address, int port);
 
-    IpAddress ipAddress();
+    IpAddress   ipAddress   () const;
+
+    int         port        () const;
 
-    int port();
+    int         family      () const    { return m_data.base.sa_family; }
 
-    int size() { return sizeof(m_data); }
+    // the length of the address structure for its family
+    int         size        () const    { return family() == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in); }
+
+    // 1.2.3.4:80 or [::1]:80
+    string      toString    () const;
 
 private:
-    char m_data[16];
+    union
+    {
+        sockaddr     base;
+        sockaddr_in  v4;
+        sockaddr_in6 v6;
+    } m_data;
 
     friend class Socket;
+    friend class UdpSocket;
     friend class IpAddress;
 };
 
@@ -82,7 +133,7 @@ enum SocketCodes
 class Socket
 {
 public:
-    enum AddressFamily  { InterNetwork = 0x02, InterNetworkV6 = 0x17 };
+    enum AddressFamily  { InterNetwork = AF_INET, InterNetworkV6 = AF_INET6 };
     enum SelectMode     { SelectNone = 0x00, SelectRead = 0x01, SelectWrite = 0x02, SelectError = 0x04 };
     enum ShutdownMode   { ShutdownRead, ShutdownWrite, ShutdownBoth, };
     enum SocketType     { TCP = 1, UDP = 2 };
@@ -94,16 +145,25 @@ public: //operations
 
     void    connect     (const IpAddress& host, int port, int timeout = 15000);
 
+    // connects a non-blocking socket, returns false while the handshake is in progress.
+    // poll for SelectWrite and call endConnect, which throws when the connect failed
+    bool    beginConnect(const IpAddress& host, int port);
+
+    void    endConnect  ();
+
     void    bind        (const IpAddress& host, int port);
 
     void    listen      (int backlog);
 
-    Socket* accept      ();
+    // returns null when the listener is non-blocking and no connection is pending
+    Socket* accept      (bool blocking = true);
 
     bool    poll        (int milliseconds, SelectMode selectMode);
 
     int     send        (const void* data, int offset, int size, int flags = 0);
 
+    int     send        (const iovec* vec, int count, int flags = 0);
+
     int     sendTo      (const void* data, int offset, int size, const IpAddress& host, int port, int flags = 0);
 
     int     receive     (void* data, int offset, int size, int flags = 0);
@@ -133,6 +193,15 @@ public: //properties
 
     void        setBlocking     (bool value);    
 
+    // IPv6 sockets accept IPv4 peers as IPv4-mapped addresses in dual mode
+    bool        dualMode        ();
+
+    void        setDualMode     (bool value);
+
+    SocketAddress localEndPoint ();
+
+    SocketAddress remoteEndPoint ();
+
     IpAddress   localAddress    ();
 
     IpAddress   remoteAddress   ();
@@ -156,6 +225,9 @@ public: //properties
     bool        reuseAddress        ();
     void        setReuseAddress     (bool value);
 
+    bool        reusePort           ();
+    void        setReusePort        (bool value);
+
     bool        tcpNoDelay          ();
     void        setTcpNoDelay       (bool value);
 
@@ -180,6 +252,9 @@ public: //properties
 protected:
     Socket(socket_t sock, byte family, byte type, bool block, bool conn);
 
+    // maps IPv4 addresses for IPv6 sockets
+    SocketAddress endPoint (const IpAddress& address, int port);
+
 protected:
     socket_t    m_socket;
     byte        m_family;
@@ -199,10 +274,26 @@ public:
         if (port) bind(IpAddress::Any, port);
     }
 
-    UdpSocket(const IpAddress& ip, int port) : Socket (InterNetwork, UDP)
+    UdpSocket(const IpAddress& ip, int port) : Socket ((AddressFamily)ip.family(), UDP)
     {
         bind(ip, port);
     }
+
+    enum { MaxBatch = 64 };
+
+    // receives up to count (at most MaxBatch) datagrams with one recvmmsg, each datagram is
+    // appended to the free space of buffers[n]. sources and timestamps (in nanoseconds of
+    // the realtime clock, 0 if unknown) are optional arrays of count entries.
+    // returns the number of datagrams received or WouldBlock
+    int     receiveBatch    (Buffer* buffers[], int count, SocketAddress* sources = 0, int64* timestamps = 0, int flags = 0);
+
+    // sends the remaining bytes of up to count (at most MaxBatch) buffers with one sendmmsg,
+    // targets may be null for a connected socket. returns the number of datagrams sent or WouldBlock
+    int     sendBatch       (Buffer* buffers[], int count, const SocketAddress* targets = 0, int flags = 0);
+
+    // kernel receive timestamps reported by receiveBatch
+    bool    timestamping    ();
+    void    setTimestamping (bool value);
 };
 
 //////////////////////////////////////////////////////////////////////////
@@ -213,10 +304,18 @@ public:
 
     NetworkStream (const IpAddress& host, int port, int connectTimeout = 15000);
 
+    // the host name is resolved with DnsResolver::shared(), its addresses are tried in order
+    NetworkStream (const char* host, int port, int connectTimeout = 15000);
+
+    NetworkStream (const string& host, int port, int connectTimeout = 15000);
+
     virtual ~NetworkStream ();
 
     inline Socket* socket () { return m_socket;  }
 
+    // resolves the host name and connects to its addresses in parallel with Connector
+    static Socket* connect (const string& host, int port, int connectTimeout = 15000);
+
     // properties
     virtual bool canRead         ();
                                  
@@ -244,6 +343,8 @@ public:
 
     virtual int  write  (const void* data, int offset, int size);
 
+    virtual int  writev (const iovec* vec, int count);
+
     virtual void flush  ();
 
     virtual void close  ();
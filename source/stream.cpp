@@ -170,4 +170,72 @@ void Stream::writeBytes(const void* data, int size)
     }
 }
 
+int Stream::writev(const iovec* vec, int count)
+{
+    int total = 0;
+
+    for (int n = 0; n < count; ++n)
+    {
+        int size = (int)vec[n].iov_len;
+        if (size == 0) continue;
+
+        int num = write(vec[n].iov_base, 0, size);
+        if (num < 0) throw IOException();
+
+        total += num;
+        if (num < size) break;
+    }
+
+    return total;
+}
+
+int64 Stream::transferTo(Stream* dest, int64 offset, int64 count)
+{
+    if (offset >= 0) seek64(offset, SeekBegin);
+
+    const int BufSize = 32768;
+    byte buffer[BufSize];
+
+    int64 total = 0;
+
+    while (count < 0 || total < count)
+    {
+        int size = (count < 0 || count - total > BufSize) ? BufSize : (int)(count - total);
+
+        int num = read(buffer, 0, size);
+        if (num < 0) throw IOException();
+        if (num == 0) break;
+
+        dest->writeBytes(buffer, num);
+        total += num;
+    }
+
+    return total;
+}
+
+void Stream::writevBytes(const iovec* vec, int count)
+{
+    std::vector<iovec> pending(vec, vec + count);
+    size_t index = 0;
+
+    while (index < pending.size())
+    {
+        int num = writev(&pending[index], pending.size() - index);
+        if (num < 0) throw IOException();
+
+        // skip the vectors fully written and advance into the partial one
+        while (index < pending.size() && (size_t)num >= pending[index].iov_len)
+        {
+            num -= pending[index].iov_len;
+            index++;
+        }
+
+        if (index < pending.size())
+        {
+            pending[index].iov_base  = (char*)pending[index].iov_base + num;
+            pending[index].iov_len  -= num;
+        }
+    }
+}
+
 END_NAMESPACE_LIB
@@ -3,6 +3,12 @@
 
 #include "types.h"
 
+#ifdef WIN32
+struct iovec { void* iov_base; size_t iov_len; };
+#else
+#include <sys/uio.h>
+#endif
+
 BEGIN_NAMESPACE_LIB
 
 enum SeekOrigin
@@ -62,6 +68,16 @@ public:
 
     // loop and write all the bytes specified by size
     virtual void    writeBytes      (const void* data, int size);
+
+    // gather write, returns the number of bytes written, possibly less than the total
+    virtual int     writev          (const iovec* vec, int count);
+
+    // loop and write all the bytes of the vectors
+    virtual void    writevBytes     (const iovec* vec, int count);
+
+    // copies count bytes (or up to end-of-stream if negative) starting at offset (or the
+    // current position if negative) into the destination, returns the bytes transferred
+    virtual int64   transferTo      (Stream* dest, int64 offset = -1, int64 count = -1);
 };
 
 class StreamWrapper : public Stream
@@ -86,6 +102,7 @@ public:
 
     virtual int     read            (void* data, int offset, int size)       { return m_stream->read(data, offset, size);  }
     virtual int     write           (const void* data, int offset, int size) { return m_stream->write(data, offset, size); }
+    virtual int     writev          (const iovec* vec, int count)            { return m_stream->writev(vec, count);        }
     virtual void    close           ()                                       { if (m_stream && m_ownStream) { delete m_stream; m_stream = 0; } }
 
     virtual void    flush           ()                          { m_stream->flush();                    }
@@ -2,6 +2,7 @@
 #include "files.h"
 #include "utils.h"
 #include "errors.h"
+#include "scan.h"
 
 BEGIN_NAMESPACE_LIB
 
@@ -49,9 +50,13 @@ string StreamReader::readToEnd()
 {
     string result;
 
-    if (stream()->canSeek())
+    if (m_stream == 0)
     {
-        int len = stream()->length();
+        result.reserve(m_end - m_pos);
+    }
+    else if (m_stream->canSeek())
+    {
+        int len = m_stream->length();
         result.reserve(len > 0 ? len + 64: 0);
     }
 
@@ -80,12 +85,16 @@ bool StreamReader::startWith(const char* value, int len, bool caseSensitive)
 
 int StreamReader::skipCharacters(const char* chars)
 {
-    int c, skipped = 0;
+    int count = strlen(chars), skipped = 0;
 
-    while ((c = read()) >= 0)
+    while (fillBuffer(1) > 0)
     {
-        if (contains(chars, c)) skipped++;
-        else { unread(c); break; }
+        const char* p = Scan::skipAny(m_buf + m_pos, m_buf + m_end, chars, count);
+
+        skipped += (int)(p - (m_buf + m_pos));
+        m_pos = (int)(p - m_buf);
+
+        if (m_pos < m_end) break;
     }
 
     return skipped;
@@ -125,16 +134,24 @@ bool StreamReader::readTo(const char* value, bool stepOver, string* result)
     int length = strlen(value);
     if (length == 0) return false;
 
-    while (length && fillBuffer(length) >= length)
+    while (fillBuffer(length) >= length)
     {
-        if (memcmp(buffer(), value, length) == 0)
+        const char* begin = m_buf + m_pos;
+        const char* end   = m_buf + m_end;
+        const char* p     = Scan::search(begin, end, value, length);
+
+        if (p < end)
         {
-            if (stepOver) skip(length);
+            if (result) result->append(begin, p - begin);
+            m_pos = (int)(p - m_buf) + (stepOver ? length : 0);
             return true;
         }
 
-        int c = read();
-        if (result) result->push_back(c);
+        // the last length - 1 bytes may start a match completed by the next fill
+        int consumed = (int)(end - begin) - (length - 1);
+
+        if (result) result->append(begin, consumed);
+        m_pos += consumed;
     }
 
     return false;
@@ -142,35 +159,31 @@ bool StreamReader::readTo(const char* value, bool stepOver, string* result)
 
 bool StreamReader::readTo(char value, bool stepOver, string* result)
 {
-    int c;
-
-    while ((c = read()) >= 0)
-    {
-        if (c == value)
-        {
-            if (!stepOver) unread(c);
-            return true;
-        }
-
-        if (result) result->push_back(c);
-    }
-
-    return false;
+    return readToFirstOf(&value, 1, stepOver, result);
 }
 
 bool StreamReader::readToFirstOf(const char* chars, bool stepOver, string* result)
 {
-    int c;
+    return readToFirstOf(chars, strlen(chars), stepOver, result);
+}
 
-    while((c = read()) >= 0)
+bool StreamReader::readToFirstOf(const char* chars, int count, bool stepOver, string* result)
+{
+    while (fillBuffer(1) > 0)
     {
-        if (contains(chars, c))
+        const char* begin = m_buf + m_pos;
+        const char* end   = m_buf + m_end;
+        const char* p     = Scan::findAny(begin, end, chars, count);
+
+        if (result) result->append(begin, p - begin);
+
+        if (p < end)
         {
-            if (!stepOver) unread(c);
+            m_pos = (int)(p - m_buf) + (stepOver ? 1 : 0);
             return true;
         }
 
-        if (result) result->push_back(c);
+        m_pos = m_end;
     }
 
     return false;
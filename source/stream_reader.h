@@ -54,6 +54,8 @@ public:
 
     bool        readToFirstOf   (const char* chars, bool stepOver, string* result);
 
+    bool        readToFirstOf   (const char* chars, int count, bool stepOver, string* result);
+
     bool        moveToFirstOf   (const char* chars, bool stepOver = true)  { return readToFirstOf(chars, stepOver, 0); }
 
     string      readToFirstOf   (const char* chars, bool stepOver = true)  { string r; readToFirstOf(chars, stepOver, &r); return r; }
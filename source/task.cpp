@@ -1,62 +1,310 @@
 #include "task.h"
+#include "timer_wheel.h"
+
+#include <unistd.h>
 
 BEGIN_NAMESPACE_LIB
 
-void TaskManager::start()
+// the worker of the calling thread, of whichever pool
+static __thread void* t_worker = 0;
+
+ThreadPool::ThreadPool (int workers) : m_next(0), m_running(false), m_stopping(false), m_draining(true), m_ordered(false), m_timers(0), m_backlogSize(0)
+{
+    init(workers);
+}
+
+ThreadPool::ThreadPool (int workers, bool ordered) : m_next(0), m_running(false), m_stopping(false), m_draining(true), m_ordered(ordered), m_timers(0), m_backlogSize(0)
+{
+    init(workers);
+}
+
+void ThreadPool::init (int workers)
+{
+    if (workers <= 0) workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers <= 0) workers = 1;
+
+    for (int n = 0; n < workers; ++n)
+    {
+        m_workers.push_back(new Worker(this, n));
+    }
+}
+
+ThreadPool::~ThreadPool ()
+{
+    // no timer may fire into the workers being deleted
+    delete m_timers;
+
+    stop(false);
+
+    for (size_t n = 0; n < m_workers.size(); ++n) delete m_workers[n];
+}
+
+void ThreadPool::start ()
 {
     if (m_running) return;
 
-    m_running = true;
-    m_thread.start(this, &TaskManager::threadEntry);
+    m_stopping = false;
+    m_running  = true;
+
+    for (size_t n = 0; n < m_workers.size(); ++n)
+    {
+        ThreadOptions options(format("pool-worker-%d", (int)n));
+        if (!m_affinity.empty()) options.cpus.push_back(m_affinity[n % m_affinity.size()]);
+
+        m_workers[n]->thread.setOptions(options);
+        m_workers[n]->thread.start(m_workers[n], &Worker::run);
+    }
 }
 
-void TaskManager::stop()
+void ThreadPool::stop (bool drain)
 {
     if (m_running)
     {
+        m_draining = drain;
+        atomic_store(&m_stopping, true);
+        m_idle.notify(true);
+
+        for (size_t n = 0; n < m_workers.size(); ++n)
+        {
+            m_workers[n]->thread.join();
+        }
+
         m_running = false;
+    }
+
+    // left over by the workers or queued while they were exiting
+    for (Task* task = nextTask(); task; task = nextTask())
+    {
+        if (drain) runTask(0, task);
+        else delete task;
+    }
+}
+
+void ThreadPool::queueTask (Task* task)
+{
+    Worker* worker = localWorker();
+
+    if (m_ordered)
+    {
+        pushBacklog(task);
+    }
+    else if (worker)
+    {
+        // run it right here when both queues of the worker are full
+        if (!worker->deque.push(task) && !worker->inbox.tryPush(task))
+        {
+            runTask(worker, task);
+            return;
+        }
+    }
+    else
+    {
+        uint count = (uint)m_workers.size();
+        uint first = atomic_add(&m_next, 1u);
+        uint n = 0;
+
+        while (n < count && !m_workers[(first + n) % count]->inbox.tryPush(task)) n++;
 
-        m_thread.join();
-        m_tasks.clear();
+        if (n == count)
+        {
+            // nobody empties the inboxes before start, else wait for the workers to catch up
+            if (!m_running) pushBacklog(task);
+            else m_workers[first % count]->inbox.push(task);
+        }
     }
+
+    m_idle.notify();
 }
 
-void TaskManager::queueTask(Task* task)
+Task* ThreadPool::nextTask (int timeout)
 {
-    m_tasks.push(task);
+    Task* task = findTask(localWorker());
+
+    if (task || timeout == 0) return task;
+
+    int64 deadline = timeout < 0 ? -1 : tickcount_us() + (int64)timeout * 1000;
+
+    for (;;)
+    {
+        int key = m_idle.prepareWait();
+
+        if ((task = findTask(localWorker())) != 0)
+        {
+            m_idle.cancelWait();
+            return task;
+        }
+
+        int wait = -1;
+
+        if (deadline >= 0)
+        {
+            int64 remain = deadline - tickcount_us();
+            if (remain <= 0) { m_idle.cancelWait(); return 0; }
+
+            wait = (int)((remain + 999) / 1000);
+        }
+
+        m_idle.commitWait(key, wait);
+    }
 }
 
-Task* TaskManager::nextTask(int timeout)
+int ThreadPool::currentWorker ()
 {
-    try { return m_tasks.wait(timeout); }
-    catch (...) { return 0; }
+    Worker* worker = localWorker();
+    return worker ? worker->index : -1;
 }
 
-bool TaskManager::running()
+int64 ThreadPool::executed ()
 {
-    return m_running;
+    int64 total = 0;
+
+    for (size_t n = 0; n < m_workers.size(); ++n) total += m_workers[n]->executed;
+
+    return total;
 }
 
-void TaskManager::threadEntry()
+int64 ThreadPool::stolen ()
 {
-    while (m_running)
+    int64 total = 0;
+
+    for (size_t n = 0; n < m_workers.size(); ++n) total += m_workers[n]->stolen;
+
+    return total;
+}
+
+TimerWheel* ThreadPool::timers ()
+{
+    TimerWheel* wheel = atomic_load(&m_timers);
+    if (wheel) return wheel;
+
+    TimerWheel* expected = 0;
+    wheel = new TimerWheel(this);
+
+    // another thread may have won the race
+    if (!atomic_cas(&m_timers, &expected, wheel))
     {
-        Task* task = nextTask(1000);
+        delete wheel;
+        return expected;
+    }
+
+    wheel->start();
+    return wheel;
+}
+
+ThreadPool::Worker* ThreadPool::localWorker ()
+{
+    Worker* worker = (Worker*)t_worker;
+    return worker && worker->pool == this ? worker : 0;
+}
+
+Task* ThreadPool::findTask (Worker* worker)
+{
+    Task* task = 0;
+
+    if (worker)
+    {
+        if (worker->deque.pop(&task))     return task;
+        if (worker->inbox.tryPop(&task))  return task;
+    }
+
+    if (popBacklog(&task)) return task;
+
+    // visit the others starting after ourselves, so thieves spread over the victims
+    int count = (int)m_workers.size();
+    int first = worker ? worker->index + 1 : 0;
+
+    for (int n = 0; n < count; ++n)
+    {
+        Worker* victim = m_workers[(first + n) % count];
+        if (victim == worker) continue;
+
+        if (victim->inbox.tryPop(&task) || victim->deque.steal(&task))
+        {
+            if (worker) worker->stolen++;
+            return task;
+        }
+    }
+
+    return 0;
+}
+
+void ThreadPool::pushBacklog (Task* task)
+{
+    ScopedLock<FastMutex> lock(m_backlogLock);
+
+    m_backlog.push_back(task);
+    atomic_store(&m_backlogSize, (int)m_backlog.size());
+}
+
+bool ThreadPool::popBacklog (Task** task)
+{
+    if (atomic_load(&m_backlogSize) == 0) return false;
+
+    ScopedLock<FastMutex> lock(m_backlogLock);
+    if (m_backlog.empty()) return false;
+
+    *task = m_backlog.front();
+    m_backlog.pop_front();
+    atomic_store(&m_backlogSize, (int)m_backlog.size());
+
+    return true;
+}
+
+void ThreadPool::runTask (Worker* worker, Task* task)
+{
+    try
+    {
+        task->run();
+    }
+    catch (...)
+    {
+        logmsg("Exception was thrown in thread pool task\n");
+    }
+
+    delete task;
+
+    if (worker) worker->executed++;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void ThreadPool::Worker::run ()
+{
+    t_worker = this;
+
+    for (;;)
+    {
+        if (atomic_load(&pool->m_stopping) && !pool->m_draining) break;
+
+        Task* task = pool->findTask(this);
 
         if (task)
         {
-            try
-            {
-                task->run();
-            }
-            catch (...)
-            {
-                logmsg("Exception was thrown in task manager");
-            }
+            pool->runTask(this, task);
+            continue;
+        }
+
+        // nothing left anywhere, so a draining stop is complete for this worker
+        if (atomic_load(&pool->m_stopping)) break;
 
-            delete task;
+        int key = pool->m_idle.prepareWait();
+
+        if ((task = pool->findTask(this)) != 0)
+        {
+            pool->m_idle.cancelWait();
+            pool->runTask(this, task);
+            continue;
         }
+
+        if (atomic_load(&pool->m_stopping))
+        {
+            pool->m_idle.cancelWait();
+            break;
+        }
+
+        pool->m_idle.commitWait(key, IdleTimeout);
     }
+
+    t_worker = 0;
 }
 
-END_NAMESPACE_LIB
\ No newline at end of file
+END_NAMESPACE_LIB
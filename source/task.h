@@ -2,11 +2,17 @@
 #define LIB_TASK_H
 
 #include "thread.h"
+#include "ring_queue.h"
 #include "delegate.h"
 #include "typehold.h"
 
+#include <deque>
+
 BEGIN_NAMESPACE_LIB
 
+template <class T> class Future;
+class TimerWheel;
+
 //////////////////////////////////////////////////////////////////////////
 struct Task
 {
@@ -14,30 +20,122 @@ struct Task
     virtual void run () = 0;
 };
 
-class TaskManager
+//////////////////////////////////////////////////////////////////////////
+// Runs tasks on a fixed set of worker threads and deletes them afterwards.
+// Every worker owns a deque for the tasks queued from its own thread, taken
+// newest first while they are warm in the cache, and an inbox for the tasks
+// queued by other threads, which are spread round-robin. Idle workers steal
+// the oldest tasks of the others before they sleep, no lock is shared by the
+// workers. Tasks may be queued before start, without limit: once the inboxes
+// are full they wait in a locked backlog. stop runs the pending tasks unless
+// told to discard them.
+class ThreadPool
 {
 public:
-    TaskManager () : m_running(false) {}
+    enum { DequeSize = 4096, InboxSize = 4096, IdleTimeout = 1000 };
+
+public:
+    // workers defaults to the number of online processors
+    ThreadPool (int workers = 0);
+
+    virtual ~ThreadPool ();
 
     void    start       ();
 
-    void    stop        ();
+    // waits for the workers, pending tasks are run when drain is set and deleted else
+    void    stop        (bool drain = true);
 
-    bool    running     ();
+    bool    running     ()  { return m_running; }
 
-    Task*   nextTask    (int timeout = 0);
+    int     workers     ()  { return (int)m_workers.size(); }
 
+    // thread safe, the task is deleted after run
     void    queueTask   (Task* task);
 
+    // run the method on a worker, the future receives its result or exception.
+    // defined in future.h
+    template <class R>
+    Future<R> queueTask (delegate<R,void> method);
+
+    template <class R, class P>
+    Future<R> queueTask (delegate<R,P> method, P param);
+
+    template <class R, class T>
+    Future<R> queueTask (T* object, R (T::*method)());
+
+    template <class R, class T, class P>
+    Future<R> queueTask (T* object, R (T::*method)(P), P param);
+
+    // takes a pending task without running it, the caller owns the task
+    Task*   nextTask    (int timeout = 0);
+
+    // pins worker n to cpus[n % cpus.size()] when started, an empty list leaves them unpinned
+    void    setAffinity (const std::vector<int>& cpus)  { m_affinity = cpus; }
+
+    // the index of the calling worker thread of this pool, -1 for other threads
+    int     currentWorker ();
+
+    int64   executed    ();
+
+    int64   stolen      ();
+
+    // delayed and periodic tasks of this pool, the wheel is created and started on first use
+    TimerWheel* timers  ();
+
 protected:
-    void    threadEntry ();
+    // ordered pools queue every task to the backlog, which runs them first in, first out
+    ThreadPool (int workers, bool ordered);
+
+    void    init        (int workers);
+
+    struct Worker
+    {
+        Worker (ThreadPool* owner, int n) : pool(owner), index(n), deque(DequeSize), inbox(InboxSize), executed(0), stolen(0) {}
+
+        ThreadPool*             pool;
+        int                     index;
+        Thread                  thread;
+        StealingDeque<Task*>    deque;      // pushed and popped by the worker only
+        MpmcQueue<Task*>        inbox;      // filled by other threads
+        int64                   executed;
+        int64                   stolen;
+
+        void run ();
+    };
+
+    Worker* localWorker ();
+
+    Task*   findTask    (Worker* worker);
+
+    void    pushBacklog (Task* task);
+
+    bool    popBacklog  (Task** task);
+
+    void    runTask     (Worker* worker, Task* task);
 
 protected:
-    typedef EventQueue<Task*> TaskQueue;
+    std::vector<Worker*>    m_workers;
+    std::vector<int>        m_affinity;
+    EventCount              m_idle;
+    volatile uint           m_next;         // round-robin inbox of foreign threads
+    volatile bool           m_running;
+    volatile bool           m_stopping;
+    bool                    m_draining;
+    bool                    m_ordered;
+    TimerWheel* volatile    m_timers;
+
+    FastMutex               m_backlogLock;
+    std::deque<Task*>       m_backlog;
+    volatile int            m_backlogSize;  // read without the lock
+};
 
-    Thread      m_thread;
-    TaskQueue   m_tasks;
-    bool        m_running;
+//////////////////////////////////////////////////////////////////////////
+// single worker pool, the tasks never run concurrently and run in the order
+// they were queued, also those queued by the tasks themselves
+class TaskManager : public ThreadPool
+{
+public:
+    TaskManager () : ThreadPool(1, true) {}
 };
 
 //////////////////////////////////////////////////////////////////////////
@@ -122,7 +220,7 @@ struct AsyncTask4 : public Task
 
     template <class T>
     AsyncTask4 (T* obj, void (T::*ent)(P1,P2,P3,P4), P1 p1, P2 p2, P3 p3, P4 p4) : method(obj, ent), params(p1, p2, p3, p4) {}
-    AsyncTask4 (method_t m, P1 p1, P2 p2, P3 p3, P4 p4) : method(m), params(p1, p2, p3) {}
+    AsyncTask4 (method_t m, P1 p1, P2 p2, P3 p3, P4 p4) : method(m), params(p1, p2, p3, p4) {}
     ~AsyncTask4() {}
 
     void run () { method.invoke(params.value, params.value2, params.value3, params.value4); }
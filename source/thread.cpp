@@ -1,16 +1,35 @@
 #include "thread.h"
+#include "utils.h"
 #include <pthread.h>
 #include <signal.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <limits.h>
+#include <map>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// the clock variants of the timed calls came with glibc 2.30 and 2.31
+#if defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 30)
+#define HAVE_MUTEX_CLOCKLOCK
+#endif
+#if __GLIBC_PREREQ(2, 31)
+#define HAVE_THREAD_CLOCKJOIN
+#endif
+#endif
 
 BEGIN_NAMESPACE_LIB
 
-timespec timeout_timespec(int timeout)
+// the time of the clock after timeout microseconds
+static timespec timeout_timespec(clockid_t clock, int64 timeout)
 {
     timespec tm;
-    clock_gettime(CLOCK_REALTIME, &tm);
+    clock_gettime(clock, &tm);
 
-    tm.tv_sec  += timeout / 1000;
-    tm.tv_nsec += (timeout % 1000) * 1000000;
+    tm.tv_sec  += timeout / 1000000;
+    tm.tv_nsec += (timeout % 1000000) * 1000;
 
     if (tm.tv_nsec >= 1000000000) { tm.tv_sec++; tm.tv_nsec -= 1000000000; }
 
@@ -37,16 +56,23 @@ Mutex::~Mutex ()
 
 bool Mutex::lock ()
 {
-    return pthread_mutex_lock((pthread_mutex_t*)handle);
+    return pthread_mutex_lock((pthread_mutex_t*)handle) == 0;
 }
 
 bool Mutex::lock (int timeout)
 {
     if (timeout < 0) return lock();
 
-    timespec tm = timeout_timespec(timeout);
+#ifdef HAVE_MUTEX_CLOCKLOCK
+    timespec tm = timeout_timespec(CLOCK_MONOTONIC, (int64)timeout * 1000);
+
+    return pthread_mutex_clocklock((pthread_mutex_t*)handle, CLOCK_MONOTONIC, &tm) == 0;
+#else
+    // without a clock parameter the deadline is CLOCK_REALTIME
+    timespec tm = timeout_timespec(CLOCK_REALTIME, (int64)timeout * 1000);
 
     return pthread_mutex_timedlock((pthread_mutex_t*)handle, &tm) == 0;
+#endif
 }
 
 bool Mutex::tryLock ()
@@ -63,7 +89,12 @@ void Mutex::unlock ()
 Condition::Condition() 
 {
     handle = new pthread_cond_t();
-    pthread_cond_init((pthread_cond_t*)handle, 0);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init((pthread_cond_t*)handle, &attr);
+    pthread_condattr_destroy(&attr);
 }
 
 Condition::~Condition()
@@ -74,13 +105,24 @@ Condition::~Condition()
 
 bool Condition::wait(Mutex& mutex, int timeout)
 {
-    if (timeout < 0)
+    return waitUntil(mutex, deadline(timeout < 0 ? -1 : (int64)timeout * 1000));
+}
+
+bool Condition::waitUs(Mutex& mutex, int64 timeout)
+{
+    return waitUntil(mutex, deadline(timeout));
+}
+
+bool Condition::waitUntil(Mutex& mutex, int64 deadline)
+{
+    if (deadline < 0)
     {
         return pthread_cond_wait((pthread_cond_t*)handle, (pthread_mutex_t*)mutex.handle) == 0;
     }
     else
     {
-        timespec tm = timeout_timespec(timeout);
+        // the condition runs on CLOCK_MONOTONIC like tickcount_us
+        timespec tm = { (time_t)(deadline / 1000000), (long)(deadline % 1000000) * 1000 };
 
         int code = pthread_cond_timedwait((pthread_cond_t*)handle, (pthread_mutex_t*)mutex.handle, &tm);
 
@@ -88,6 +130,11 @@ bool Condition::wait(Mutex& mutex, int timeout)
     }
 }
 
+int64 Condition::deadline(int64 timeout)
+{
+    return timeout < 0 ? -1 : tickcount_us() + timeout;
+}
+
 void Condition::broadcast()
 {
     pthread_cond_broadcast((pthread_cond_t*)handle);
@@ -103,32 +150,35 @@ Event::Event () : signaled (false)
 {
 }
 
+// signaled under the lock, a waiter may destroy the event as soon as it returns
 void Event::notify ()
 {
-    mutex.lock();
+    AutoLock lock(mutex);
     signaled = true;
-    mutex.unlock();
-
     cond.signal();
 }
 
 void Event::notifyAll ()
 {
-    mutex.lock();
+    AutoLock lock(mutex);
     signaled = true;
-    mutex.unlock();
-
     cond.broadcast();
 }
 
 bool Event::wait (int timeout)
+{
+    return waitUs(timeout < 0 ? -1 : (int64)timeout * 1000);
+}
+
+bool Event::waitUs (int64 timeout)
 {
     AutoLock lock(mutex);
+    int64 deadline = Condition::deadline(timeout);
 
     while (signaled == false)
     {
         // false return indicates a timeout
-        if (!cond.wait(mutex, timeout)) return false;
+        if (!cond.waitUntil(mutex, deadline)) return signaled;
     }
 
     return true;
@@ -142,10 +192,203 @@ void Event::reset()
 }
 
 //////////////////////////////////////////////////////////////////////////
+bool Futex::wait (volatile int* address, int expected, int timeout)
+{
+    timespec tm = { timeout / 1000, (timeout % 1000) * 1000000 };
+
+    // the timeout of FUTEX_WAIT is relative
+    int err = syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, expected, timeout < 0 ? NULL : &tm, NULL, 0);
+
+    return err == 0 || errno != ETIMEDOUT;
+}
+
+int Futex::wake (volatile int* address, int count)
+{
+    return (int)syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+//////////////////////////////////////////////////////////////////////////
+bool FastMutex::lockSlow (int timeout)
+{
+    atomic_add(&m_contended, (int64)1);
+
+    // the owner may be about to leave, sleeping costs two system calls
+    for (int n = 0; n < SpinCount; ++n)
+    {
+        int expected = Unlocked;
+        if (atomic_relaxed(&m_state) == Unlocked && atomic_cas(&m_state, &expected, (int)Locked)) return true;
+
+        cpu_relax();
+    }
+
+    int64 deadline = timeout < 0 ? -1 : tickcount_us() + (int64)timeout * 1000;
+
+    // once marked contended, unlock wakes one of the sleepers
+    while (atomic_exchange(&m_state, (int)Contended) != Unlocked)
+    {
+        int wait = -1;
+
+        if (deadline >= 0)
+        {
+            int64 remain = deadline - tickcount_us();
+            if (remain <= 0) return false;
+
+            wait = (int)((remain + 999) / 1000);
+        }
+
+        atomic_add(&m_waits, (int64)1);
+        Futex::wait(&m_state, Contended, wait);
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void SharedMutex::lockSlow ()
+{
+    atomic_add(&m_contended, (int64)1);
+
+    for (int spins = 0; ; ++spins)
+    {
+        int state = atomic_relaxed(&m_state);
+
+        if ((state & (Writer | Readers)) == 0)
+        {
+            // clears pending, the other waiting writers set it again
+            if (atomic_cas(&m_state, &state, (int)Writer)) return;
+            continue;
+        }
+
+        if (!(state & Pending))
+        {
+            atomic_cas(&m_state, &state, state | Pending);
+            continue;
+        }
+
+        if (spins < SpinCount) cpu_relax();
+        else sleep(state);
+    }
+}
+
+void SharedMutex::lockSharedSlow ()
+{
+    atomic_add(&m_contended, (int64)1);
+
+    for (int spins = 0; ; ++spins)
+    {
+        int state = atomic_relaxed(&m_state);
+
+        if (!(state & (Writer | Pending)))
+        {
+            if (atomic_cas(&m_state, &state, state + 1)) return;
+            continue;
+        }
+
+        if (spins < SpinCount) cpu_relax();
+        else sleep(state);
+    }
+}
+
+void SharedMutex::sleep (int state)
+{
+    // registered before the futex compares the state, so no wake up is lost
+    atomic_add(&m_sleepers, 1);
+    atomic_add(&m_waits, (int64)1);
+
+    Futex::wait(&m_state, state);
+
+    atomic_add(&m_sleepers, -1);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// the started threads and their names, until joined
+struct ThreadRegistry
+{
+    Mutex                       lock;
+    std::map<thread_t, string>  threads;
+};
+
+static ThreadRegistry& thread_registry()
+{
+    static ThreadRegistry registry;
+    return registry;
+}
+
+static void fill_cpuset(const std::vector<int>& cpus, cpu_set_t* set)
+{
+    CPU_ZERO(set);
+
+    for (size_t n = 0; n < cpus.size(); ++n)
+    {
+        if (cpus[n] >= 0 && cpus[n] < CPU_SETSIZE) CPU_SET(cpus[n], set);
+    }
+}
+
 thread_t Thread::createThread(void* (*routine)(void*), void* args)
 {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+
+    if (options.stackSize > 0)
+    {
+        pthread_attr_setstacksize(&attr, options.stackSize < PTHREAD_STACK_MIN ? PTHREAD_STACK_MIN : options.stackSize);
+    }
+
+    if (!options.cpus.empty())
+    {
+        cpu_set_t cpus;
+        fill_cpuset(options.cpus, &cpus);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+
+    if (options.priority > 0)
+    {
+        sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = options.priority;
+
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &param);
+    }
+
     pthread_t handle;
-    pthread_create(&handle, 0, routine, args);
+    int err = pthread_create(&handle, &attr, routine, args);
+
+    if (err == EPERM && options.priority > 0)
+    {
+        log_warn("Thread %s: SCHED_FIFO is not permitted, running with normal priority\n", options.name.c_str());
+
+        pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+        err = pthread_create(&handle, &attr, routine, args);
+    }
+
+    if (err == EINVAL && !options.cpus.empty())
+    {
+        log_warn("Thread %s: invalid cpus, running unpinned\n", options.name.c_str());
+
+        // the mask of the calling thread is valid
+        cpu_set_t cpus;
+        sched_getaffinity(0, sizeof(cpus), &cpus);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+
+        err = pthread_create(&handle, &attr, routine, args);
+    }
+
+    pthread_attr_destroy(&attr);
+
+    if (err)
+    {
+        errno = err;
+        throw RuntimeException("Thread could not be created");
+    }
+
+    // the kernel keeps 15 characters and the terminator
+    if (!options.name.empty()) pthread_setname_np(handle, options.name.substr(0, 15).c_str());
+
+    ThreadRegistry& registry = thread_registry();
+    AutoLock lock(registry.lock);
+    registry.threads[handle] = options.name;
 
     return handle;
 }
@@ -162,10 +405,20 @@ bool Thread::join(int timeout)
         }
         else
         {
-            timespec tm = timeout_timespec(timeout);
+#ifdef HAVE_THREAD_CLOCKJOIN
+            timespec tm = timeout_timespec(CLOCK_MONOTONIC, (int64)timeout * 1000);
+            code = pthread_clockjoin_np(handle, 0, CLOCK_MONOTONIC, &tm);
+#else
+            timespec tm = timeout_timespec(CLOCK_REALTIME, (int64)timeout * 1000);
             code = pthread_timedjoin_np(handle, 0, &tm);
+#endif
         }
         
+        ThreadRegistry& registry = thread_registry();
+        registry.lock.lock();
+        registry.threads.erase(handle);
+        registry.lock.unlock();
+
         handle = 0;
         return code == 0;
     }
@@ -173,6 +426,52 @@ bool Thread::join(int timeout)
     return false;
 }
 
+bool Thread::setAffinity(const std::vector<int>& cpus)
+{
+    if (handle == 0) return false;
+
+    cpu_set_t set;
+    fill_cpuset(cpus, &set);
+
+    return pthread_setaffinity_np(handle, sizeof(set), &set) == 0;
+}
+
+int64 Thread::cpuTime()
+{
+    return handle ? cpuTime(handle) : -1;
+}
+
+int64 Thread::cpuTime(thread_t id)
+{
+    clockid_t clock;
+    timespec tm;
+
+    if (pthread_getcpuclockid((pthread_t)id, &clock) != 0) return -1;
+    if (clock_gettime(clock, &tm) != 0) return -1;
+
+    return (int64)tm.tv_sec * 1000000 + tm.tv_nsec / 1000;
+}
+
+std::vector<ThreadInfo> Thread::threads()
+{
+    std::vector<ThreadInfo> result;
+
+    ThreadRegistry& registry = thread_registry();
+    AutoLock lock(registry.lock);
+
+    for (std::map<thread_t, string>::iterator it = registry.threads.begin(); it != registry.threads.end(); ++it)
+    {
+        ThreadInfo info;
+        info.id      = it->first;
+        info.name    = it->second;
+        info.cpuTime = cpuTime(it->first);
+
+        result.push_back(info);
+    }
+
+    return result;
+}
+
 thread_t Thread::currentId()
 {
     return (thread_t)pthread_self();
@@ -3,13 +3,19 @@
 
 #include "types.h"
 #include "errors.h"
+#include "atomic.h"
 #include <deque>
+#include <vector>
 
 typedef void*           handle_t;
 typedef unsigned long   thread_t;
 
 BEGIN_NAMESPACE_LIB
 
+//////////////////////////////////////////////////////////////////////////
+// The timed waits of the locks below run on CLOCK_MONOTONIC, the same clock
+// as tickcount_us, so setting the system time neither cuts nor stretches them.
+
 //////////////////////////////////////////////////////////////////////////
 class Mutex
 {
@@ -20,6 +26,7 @@ public:
 
     virtual bool lock    () ;
 
+    // returns false on timeout
     virtual bool lock    (int timeout);
 
     virtual bool tryLock ();
@@ -63,8 +70,19 @@ public:
     
     void broadcast ();
 
+    // returns false on timeout, the timeout is in milliseconds
     bool wait (Mutex& mutex, int timeout = -1);
 
+    // timeout in microseconds
+    bool waitUs (Mutex& mutex, int64 timeout);
+
+    // deadline in tickcount_us, waits forever when negative. Waiting in a loop
+    // against one deadline keeps spurious wake ups from extending the timeout
+    bool waitUntil (Mutex& mutex, int64 deadline);
+
+    // the tickcount_us deadline of a timeout in microseconds, -1 for no timeout
+    static int64 deadline (int64 timeout);
+
 protected:
     handle_t handle;
 };
@@ -80,6 +98,9 @@ public:
 
     bool wait      (int timeout = -1);
 
+    // timeout in microseconds
+    bool waitUs    (int64 timeout);
+
     void reset     ();
 
 protected:
@@ -90,11 +111,194 @@ protected:
 
 
 //////////////////////////////////////////////////////////////////////////
+// The futex system call, threads sleep on a 32-bit word and are only put to
+// sleep by the kernel while the word still holds the expected value
+class Futex
+{
+public:
+    enum { All = 0x7FFFFFFF };
+
+    // returns false on timeout, true when woken, interrupted or the value differed
+    static bool wait (volatile int* address, int expected, int timeout = -1);
+
+    // returns the number of threads woken up
+    static int  wake (volatile int* address, int count = 1);
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+// Non-recursive mutex on a futex word, which spins a while before it sleeps.
+// Locking and unlocking without contention is a single atomic instruction,
+// no heap and no system call. Locking it twice on one thread deadlocks and
+// it can not be waited on with Condition, Mutex is still there for those.
+class FastMutex
+{
+public:
+    enum { SpinCount = 100 };
+
+    FastMutex () : m_state(Unlocked), m_contended(0), m_waits(0) { }
+
+    void    lock        ()  { int expected = Unlocked; if (!atomic_cas(&m_state, &expected, (int)Locked)) lockSlow(-1); }
+
+    // returns false on timeout
+    bool    lock        (int timeout)   { int expected = Unlocked; return atomic_cas(&m_state, &expected, (int)Locked) || lockSlow(timeout); }
+
+    bool    tryLock     ()  { int expected = Unlocked; return atomic_cas(&m_state, &expected, (int)Locked); }
+
+    void    unlock      ()  { if (atomic_exchange(&m_state, (int)Unlocked) == Contended) Futex::wake(&m_state); }
+
+    // lock calls which found the mutex held
+    int64   contended   ()  { return atomic_relaxed(&m_contended); }
+
+    // times a thread went to sleep on the mutex
+    int64   waits       ()  { return atomic_relaxed(&m_waits); }
+
+protected:
+    enum { Unlocked = 0, Locked = 1, Contended = 2 };
+
+    bool    lockSlow    (int timeout);
+
+protected:
+    volatile int    m_state;
+    volatile int64  m_contended;
+    volatile int64  m_waits;
+
+private:
+    FastMutex (const FastMutex&);
+    FastMutex& operator = (const FastMutex&);
+};
+
+//////////////////////////////////////////////////////////////////////////
+// Reader/writer lock on a futex word, readers share the lock while no writer
+// holds or waits for it. A waiting writer holds back new readers, so a steady
+// stream of readers can not starve it. Neither side is recursive.
+class SharedMutex
+{
+public:
+    enum { SpinCount = 100 };
+
+    SharedMutex () : m_state(0), m_sleepers(0), m_contended(0), m_waits(0) { }
+
+    void    lock        ()  { int expected = 0; if (!atomic_cas(&m_state, &expected, (int)Writer)) lockSlow(); }
+
+    bool    tryLock     ()  { int expected = 0; return atomic_cas(&m_state, &expected, (int)Writer); }
+
+    void    unlock      ()  { atomic_add(&m_state, -(int)Writer); wakeAll(); }
+
+    void    lockShared  ()
+    {
+        int state = atomic_relaxed(&m_state);
+        if ((state & (Writer | Pending)) || !atomic_cas(&m_state, &state, state + 1)) lockSharedSlow();
+    }
+
+    bool    tryLockShared ()
+    {
+        int state = atomic_relaxed(&m_state);
+        return !(state & (Writer | Pending)) && atomic_cas(&m_state, &state, state + 1);
+    }
+
+    // the last reader lets a waiting writer in
+    void    unlockShared ()  { if ((atomic_add(&m_state, -1) & Readers) == 0) wakeAll(); }
+
+    // lock calls of either kind which had to wait
+    int64   contended   ()  { return atomic_relaxed(&m_contended); }
+
+    // times a thread went to sleep on the lock
+    int64   waits       ()  { return atomic_relaxed(&m_waits); }
+
+protected:
+    enum { Writer = 1 << 30, Pending = 1 << 29, Readers = Pending - 1 };
+
+    void    lockSlow        ();
+
+    void    lockSharedSlow  ();
+
+    void    sleep           (int state);
+
+    void    wakeAll         ()  { if (atomic_load(&m_sleepers)) Futex::wake(&m_state, Futex::All); }
+
+protected:
+    volatile int    m_state;        // the reader count and the writer flags
+    volatile int    m_sleepers;
+    volatile int64  m_contended;
+    volatile int64  m_waits;
+
+private:
+    SharedMutex (const SharedMutex&);
+    SharedMutex& operator = (const SharedMutex&);
+};
+
+// holds any lock with lock and unlock for the scope, AutoLock for the others
+template <class L>
+class ScopedLock
+{
+public:
+    ScopedLock  (L& m) : mutex(&m) { lock(); }
+
+    ~ScopedLock ()  { if (locked) unlock(); }
+
+    void lock   ()  { mutex->lock();   locked = true;  }
+
+    void unlock ()  { mutex->unlock(); locked = false; }
+
+private:
+    L*   mutex;
+    bool locked;
+};
+
+// holds a SharedMutex as reader for the scope
+class SharedLock
+{
+public:
+    SharedLock  (SharedMutex& m) : mutex(&m) { lock(); }
+
+    ~SharedLock ()  { if (locked) unlock(); }
+
+    void lock   ()  { mutex->lockShared();   locked = true;  }
+
+    void unlock ()  { mutex->unlockShared(); locked = false; }
+
+private:
+    SharedMutex* mutex;
+    bool         locked;
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+// Applied when the thread is created. SCHED_FIFO needs CAP_SYS_NICE, without
+// it the thread runs with normal priority, and cpus which do not exist leave
+// it unpinned. Both are logged as warnings rather than failing the start.
+struct ThreadOptions
+{
+    ThreadOptions (const string& threadName = string()) : name(threadName), stackSize(0), priority(0) { }
+
+    string              name;       // shown by top and ps, cut to 15 characters
+    std::vector<int>    cpus;       // the cpus it may run on, empty for all
+    int                 stackSize;  // in bytes, 0 for the default
+    int                 priority;   // SCHED_FIFO priority 1 to 99, 0 for normal scheduling
+};
+
+// an entry of Thread::threads
+struct ThreadInfo
+{
+    thread_t            id;
+    string              name;
+    int64               cpuTime;    // in microseconds, -1 when the thread has exited
+};
+
+//////////////////////////////////////////////////////////////////////////
+// Started threads are kept in a registry until joined, Thread::threads lists
+// them with the processor time used so far.
 class Thread
 {
 public:
     Thread() : handle(0) { }
 
+    Thread(const ThreadOptions& threadOptions) : handle(0), options(threadOptions) { }
+
+    // takes effect at the next start
+    void setOptions (const ThreadOptions& threadOptions)    { options = threadOptions; }
+
     template<class T>
     void start (T* object, void (T::*entry) ())
     {
@@ -130,8 +334,18 @@ public:
 
     thread_t id  () { return handle; }
 
+    // pins the running thread, returns false when the cpus are invalid
+    bool setAffinity (const std::vector<int>& cpus);
+
+    // microseconds of processor time used by the thread, -1 when not running
+    int64 cpuTime ();
+
     static thread_t currentId ();
 
+    static int64 cpuTime (thread_t id);
+
+    static std::vector<ThreadInfo> threads ();
+
 protected:
     template<class T> struct wrapper
     {
@@ -159,12 +373,13 @@ protected:
         }
     };
 
-    static thread_t createThread(void* (*routine)(void*), void* args);
+    thread_t createThread(void* (*routine)(void*), void* args);
 
 protected:
-    enum { HolderSize = 28 }; // be careful about the data size
-    thread_t  handle;
-    char      holder[HolderSize];
+    enum { HolderSize = 4 * sizeof(void*) }; // an object and a member function pointer with an argument
+    thread_t        handle;
+    union { char holder[HolderSize]; void* aligner; };
+    ThreadOptions   options;
 };
 
 
@@ -175,17 +390,34 @@ class EventQueue
 public:
     typedef typename std::deque<T>::iterator iterator;
 
+    EventQueue () : waiters(0) { }
+
     void push (T object)
     {
         AutoLock lock(mutex);
         queue.push_back(object);
-        cond.signal();
+
+        // nobody to wake up while the consumers are busy
+        if (waiters) cond.signal();
+    }
+
+    // one lock and at most one wake up per waiting consumer for the whole batch
+    void pushMany (const std::vector<T>& objects)
+    {
+        if (objects.empty()) return;
+
+        AutoLock lock(mutex);
+        queue.insert(queue.end(), objects.begin(), objects.end());
+
+        if (waiters == 1 || (waiters && objects.size() == 1)) cond.signal();
+        else if (waiters) cond.broadcast();
     }
 
     template <class Predicate>
     T find (Predicate pred, int timeout = -1)
     {
         AutoLock lock(mutex);
+        int64 deadline = Condition::deadline(timeout < 0 ? -1 : (int64)timeout * 1000);
 
         while (true)
         {
@@ -195,7 +427,7 @@ public:
             }
 
             // return false indicates a timeout
-            if (!cond.wait(mutex, timeout)) break;
+            if (!sleep(deadline)) break;
         }
 
         throw TimeoutException("Timeout while EventQueue::find");
@@ -231,11 +463,12 @@ public:
     T peek (int timeout = -1)
     {
         AutoLock lock(mutex);
+        int64 deadline = Condition::deadline(timeout < 0 ? -1 : (int64)timeout * 1000);
 
         while (queue.size() == 0)
         {
             // return false indicates a timeout
-            if (!cond.wait(mutex, timeout)) throw TimeoutException("Timeout while EventQueue::wait");
+            if (!sleep(deadline) && queue.size() == 0) throw TimeoutException("Timeout while EventQueue::wait");
         }
 
         T item = queue.front();
@@ -243,13 +476,20 @@ public:
     }
 
     T wait (int timeout = -1)
+    {
+        return waitUs(timeout < 0 ? -1 : (int64)timeout * 1000);
+    }
+
+    // timeout in microseconds
+    T waitUs (int64 timeout)
     {
         AutoLock lock(mutex);
+        int64 deadline = Condition::deadline(timeout);
 
         while (queue.size() == 0)
         {
             // return false indicates a timeout
-            if (!cond.wait(mutex, timeout)) throw TimeoutException("Timeout while EventQueue::wait");
+            if (!sleep(deadline) && queue.size() == 0) throw TimeoutException("Timeout while EventQueue::wait");
         }
 
         T item = queue.front();
@@ -258,10 +498,62 @@ public:
         return item;
     }
 
+    // waits for the first item, then takes up to maxItems in the same lock.
+    // returns the number of items appended
+    int waitMany (std::vector<T>& items, int maxItems, int timeout = -1)
+    {
+        AutoLock lock(mutex);
+        int64 deadline = Condition::deadline(timeout < 0 ? -1 : (int64)timeout * 1000);
+
+        while (queue.size() == 0)
+        {
+            // return false indicates a timeout
+            if (!sleep(deadline) && queue.size() == 0) throw TimeoutException("Timeout while EventQueue::waitMany");
+        }
+
+        return take(items, maxItems);
+    }
+
+    // takes up to maxItems without waiting, all of them when maxItems is negative
+    int drain (std::vector<T>& items, int maxItems = -1)
+    {
+        AutoLock lock(mutex);
+        return take(items, maxItems);
+    }
+
+    int size ()
+    {
+        AutoLock lock(mutex);
+        return (int)queue.size();
+    }
+
+protected:
+    int take (std::vector<T>& items, int maxItems)
+    {
+        size_t count = queue.size();
+        if (maxItems >= 0 && count > (size_t)maxItems) count = maxItems;
+
+        items.insert(items.end(), queue.begin(), queue.begin() + count);
+        queue.erase(queue.begin(), queue.begin() + count);
+
+        return (int)count;
+    }
+
+    // counts the sleeping consumers, so producers only signal when needed
+    bool sleep (int64 deadline)
+    {
+        waiters++;
+        bool woken = cond.waitUntil(mutex, deadline);
+        waiters--;
+
+        return woken;
+    }
+
 protected:
     std::deque<T> queue;
     Mutex mutex;
     Condition cond;
+    int waiters;
 };
 
 END_NAMESPACE_LIB
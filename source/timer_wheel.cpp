@@ -0,0 +1,416 @@
+#include "timer_wheel.h"
+#include "utils.h"
+
+#include <time.h>
+
+BEGIN_NAMESPACE_LIB
+
+TimerWheel::TimerWheel (ThreadPool* pool, int resolution)
+  : m_pool(pool), m_resolution(resolution > 0 ? resolution : 1), m_current(0), m_count(0), m_running(false), m_wakeTick(-1)
+{
+    m_origin = tickcount_us();
+
+    for (int n = 0; n < RootSize; ++n) m_root[n].prev = m_root[n].next = &m_root[n];
+
+    for (int level = 0; level < Levels; ++level)
+    {
+        for (int n = 0; n < LevelSize; ++n) m_levels[level][n].prev = m_levels[level][n].next = &m_levels[level][n];
+    }
+}
+
+TimerWheel::~TimerWheel ()
+{
+    stop();
+
+    for (size_t n = 0; n < m_entries.size(); ++n)
+    {
+        // pending tasks are dropped without running
+        if (m_entries[n]->prev) delete m_entries[n]->task;
+        delete m_entries[n];
+    }
+}
+
+TimerWheel::TimerId TimerWheel::scheduleAfter (int milliseconds, TimerHandler handler)
+{
+    return add(nowTick() + toTicks(milliseconds), 0, handler, 0);
+}
+
+TimerWheel::TimerId TimerWheel::scheduleAfter (int milliseconds, Task* task)
+{
+    return add(nowTick() + toTicks(milliseconds), 0, TimerHandler(), task);
+}
+
+TimerWheel::TimerId TimerWheel::scheduleAt (const DateTime& time, TimerHandler handler)
+{
+    int64 delay = (time.epochSeconds() - (int64)::time(0)) * 1000;
+
+    if (delay < 0) delay = 0;
+    if (delay > 0x7FFFFFFF) delay = 0x7FFFFFFF;
+
+    return scheduleAfter((int)delay, handler);
+}
+
+TimerWheel::TimerId TimerWheel::schedulePeriodic (int period, TimerHandler handler, int delay)
+{
+    int ticks = toTicks(period);
+    if (ticks < 1) ticks = 1;
+
+    return add(nowTick() + (delay < 0 ? ticks : toTicks(delay)), ticks, handler, 0);
+}
+
+bool TimerWheel::cancel (TimerId id)
+{
+    uint index      = (uint)(id & 0xFFFFFFFF);
+    uint generation = (uint)(id >> 32);
+
+    m_lock.lock();
+
+    Entry* entry = index < m_entries.size() ? m_entries[index] : 0;
+
+    if (entry == 0 || entry->generation != generation || entry->prev == 0)
+    {
+        m_lock.unlock();
+        return false;
+    }
+
+    Task* task = entry->task;
+
+    unlink(entry);
+    free(entry);
+    m_count--;
+
+    m_lock.unlock();
+
+    delete task;
+    return true;
+}
+
+int TimerWheel::count ()
+{
+    AutoLock lock(m_lock);
+    return m_count;
+}
+
+int TimerWheel::advance ()
+{
+    std::vector<Fired> fired;
+
+    m_lock.lock();
+
+    int64 now = nowTick();
+
+    // nothing to catch up on, an idle wheel skips the elapsed ticks
+    if (m_count == 0 && m_current <= now) m_current = now + 1;
+
+    while (m_current <= now)
+    {
+        int index = (int)(m_current & (RootSize - 1));
+
+        if (index == 0) cascade(0);
+
+        Entry* head = &m_root[index];
+
+        while (head->next != head)
+        {
+            Entry* entry = head->next;
+            unlink(entry);
+
+            // timers beyond the range of the wheel come around more than once
+            if (entry->expires > m_current) { insert(entry); continue; }
+
+            Fired item = { entry->handler, entry->task };
+            fired.push_back(item);
+
+            if (entry->period > 0)
+            {
+                // rescheduled before it runs, so the handler may cancel it
+                entry->expires += entry->period;
+                if (entry->expires <= m_current) entry->expires = m_current + entry->period;
+
+                insert(entry);
+            }
+            else
+            {
+                free(entry);
+                m_count--;
+            }
+        }
+
+        m_current++;
+
+        // jumps over the ticks without work instead of visiting them one by one
+        if (m_current <= now && m_root[m_current & (RootSize - 1)].next == &m_root[m_current & (RootSize - 1)])
+        {
+            int64 tick = nextTick();
+            m_current = tick < 0 || tick > now ? now + 1 : tick;
+        }
+    }
+
+    m_lock.unlock();
+
+    for (size_t n = 0; n < fired.size(); ++n)
+    {
+        Task* task = fired[n].task;
+
+        if (m_pool)
+        {
+            m_pool->queueTask(task ? task : new AsyncTask<void>(fired[n].handler));
+            continue;
+        }
+
+        try
+        {
+            if (task) task->run();
+            else fired[n].handler.invoke();
+        }
+        catch (...)
+        {
+            logmsg("Exception was thrown in timer handler\n");
+        }
+
+        delete task;
+    }
+
+    return (int)fired.size();
+}
+
+int TimerWheel::nextTimeout ()
+{
+    m_lock.lock();
+    int64 tick = nextTick();
+    m_lock.unlock();
+
+    if (tick < 0) return -1;
+
+    int64 remain = m_origin + tick * m_resolution * 1000 - tickcount_us();
+
+    return remain <= 0 ? 0 : (int)((remain + 999) / 1000);
+}
+
+void TimerWheel::start ()
+{
+    if (m_running) return;
+
+    m_running = true;
+    m_thread.setOptions(ThreadOptions("timer-wheel"));
+    m_thread.start(this, &TimerWheel::threadEntry);
+}
+
+void TimerWheel::stop ()
+{
+    if (!m_running) return;
+
+    m_lock.lock();
+    m_running = false;
+    m_cond.signal();
+    m_lock.unlock();
+
+    m_thread.join();
+}
+
+//////////////////////////////////////////////////////////////////////////
+int64 TimerWheel::nowTick ()
+{
+    return (tickcount_us() - m_origin) / (m_resolution * 1000);
+}
+
+int TimerWheel::toTicks (int milliseconds)
+{
+    return milliseconds <= 0 ? 0 : (milliseconds + m_resolution - 1) / m_resolution;
+}
+
+TimerWheel::TimerId TimerWheel::add (int64 expires, int period, TimerHandler handler, Task* task)
+{
+    AutoLock lock(m_lock);
+
+    // the wheel may have been idle for long, the entry is filed relative to the present
+    if (m_count == 0)
+    {
+        int64 now = nowTick();
+        if (m_current < now) m_current = now;
+    }
+
+    Entry* entry = allocate();
+    entry->expires = expires;
+    entry->period  = period;
+    entry->handler = handler;
+    entry->task    = task;
+
+    insert(entry);
+    m_count++;
+
+    if (m_running && (m_wakeTick < 0 || expires < m_wakeTick)) m_cond.signal();
+
+    return ((int64)entry->generation << 32) | (uint)entry->index;
+}
+
+void TimerWheel::insert (Entry* entry)
+{
+    int64 expires = entry->expires;
+    if (expires < m_current) expires = m_current;
+
+    int64 delta = expires - m_current;
+
+    if (delta < RootSize)
+    {
+        link(&m_root[expires & (RootSize - 1)], entry);
+        return;
+    }
+
+    for (int level = 0; level < Levels; ++level)
+    {
+        int shift = RootBits + level * LevelBits;
+
+        if (delta < ((int64)1 << (shift + LevelBits)) || level == Levels - 1)
+        {
+            // beyond the last wheel the timer waits one full turn and is inserted again
+            if (delta >= ((int64)1 << (shift + LevelBits))) expires = m_current + ((int64)1 << (shift + LevelBits)) - 1;
+
+            link(&m_levels[level][(expires >> shift) & (LevelSize - 1)], entry);
+            return;
+        }
+    }
+}
+
+void TimerWheel::cascade (int level)
+{
+    for (; level < Levels; ++level)
+    {
+        int index = (int)((m_current >> (RootBits + level * LevelBits)) & (LevelSize - 1));
+        Entry* head = &m_levels[level][index];
+
+        if (head->next != head)
+        {
+            // detach the slot first, its entries are spread over the lower wheels
+            Entry* entry = head->next;
+            head->prev->next = 0;
+            head->prev = head->next = head;
+
+            while (entry)
+            {
+                Entry* next = entry->next;
+                insert(entry);
+                entry = next;
+            }
+        }
+
+        if (index != 0) break;
+    }
+}
+
+TimerWheel::Entry* TimerWheel::allocate ()
+{
+    if (!m_free.empty())
+    {
+        Entry* entry = m_entries[m_free.back()];
+        m_free.pop_back();
+        return entry;
+    }
+
+    Entry* entry = new Entry();
+    entry->prev       = 0;
+    entry->next       = 0;
+    entry->task       = 0;
+    entry->index      = (int)m_entries.size();
+    entry->generation = 1;
+
+    m_entries.push_back(entry);
+    return entry;
+}
+
+void TimerWheel::free (Entry* entry)
+{
+    entry->prev = entry->next = 0;
+    entry->task = 0;
+    entry->handler.disconnect();
+
+    // stale ids of the entry do not match anymore
+    if (++entry->generation == 0) entry->generation = 1;
+
+    m_free.push_back(entry->index);
+}
+
+int64 TimerWheel::nextTick ()
+{
+    if (m_count == 0) return -1;
+
+    int64 next = -1;
+
+    // one turn of the root wheel, its slots may already hold ticks past the next cascade
+    for (int64 tick = m_current; tick < m_current + RootSize; ++tick)
+    {
+        Entry* head = &m_root[tick & (RootSize - 1)];
+
+        if (head->next != head)
+        {
+            next = tick;
+            break;
+        }
+    }
+
+    // a slot of a coarser wheel is cascaded on the first tick of its turn
+    for (int level = 0; level < Levels; ++level)
+    {
+        int   shift = RootBits + level * LevelBits;
+        int64 turn  = ((m_current + ((int64)1 << shift) - 1) >> shift) << shift;
+
+        for (int n = 0; n < LevelSize; ++n, turn += (int64)1 << shift)
+        {
+            if (next >= 0 && turn >= next) break;
+
+            Entry* head = &m_levels[level][(turn >> shift) & (LevelSize - 1)];
+
+            if (head->next != head)
+            {
+                next = turn;
+                break;
+            }
+        }
+    }
+
+    return next;
+}
+
+void TimerWheel::threadEntry ()
+{
+    while (m_running)
+    {
+        advance();
+
+        m_lock.lock();
+
+        if (m_running)
+        {
+            int64 tick = nextTick();
+
+            // the condition runs on the clock of tickcount_us, so it wakes right at the tick
+            int64 deadline = tick < 0 ? -1 : m_origin + tick * m_resolution * 1000;
+
+            if (deadline < 0 || deadline > tickcount_us())
+            {
+                m_wakeTick = tick;
+                m_cond.waitUntil(m_lock, deadline);
+                m_wakeTick = -1;
+            }
+        }
+
+        m_lock.unlock();
+    }
+}
+
+void TimerWheel::link (Entry* head, Entry* entry)
+{
+    entry->prev = head->prev;
+    entry->next = head;
+    head->prev->next = entry;
+    head->prev = entry;
+}
+
+void TimerWheel::unlink (Entry* entry)
+{
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    entry->prev = entry->next = 0;
+}
+
+END_NAMESPACE_LIB
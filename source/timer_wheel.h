@@ -0,0 +1,125 @@
+#ifndef LIB_TIMER_WHEEL_H
+#define LIB_TIMER_WHEEL_H
+
+#include "task.h"
+#include "datetime.h"
+
+BEGIN_NAMESPACE_LIB
+
+//////////////////////////////////////////////////////////////////////////
+// Hierarchical timing wheel for large numbers of timeouts. Timers sit in
+// intrusive lists of a 256 slot wheel for the next ticks and four coarser
+// wheels of 64 slots, which cascade down as time advances. Scheduling and
+// cancelling are O(1) and an idle wheel costs nothing. Time is taken from
+// tickcount_us, a DateTime only fixes the delay when the timer is scheduled.
+//
+// Expired timers are queued to the thread pool, or invoked on the thread
+// advancing the wheel without one. The wheel either runs its own thread
+// after start() or is driven by calling advance() from an event loop.
+class TimerWheel
+{
+public:
+    typedef delegate<void, void> TimerHandler;
+    typedef int64                TimerId;
+
+    enum { InvalidTimer = 0 };
+
+public:
+    // resolution is the length of a tick in milliseconds
+    TimerWheel (ThreadPool* pool = 0, int resolution = 1);
+
+    virtual ~TimerWheel ();
+
+    TimerId scheduleAfter   (int milliseconds, TimerHandler handler);
+
+    // the task is deleted after it has run, or when the timer is cancelled
+    TimerId scheduleAfter   (int milliseconds, Task* task);
+
+    TimerId scheduleAt      (const DateTime& time, TimerHandler handler);
+
+    // first fires after delay, or after one period when delay is negative
+    TimerId schedulePeriodic(int period, TimerHandler handler, int delay = -1);
+
+    // returns false when the timer already fired or was cancelled
+    bool    cancel          (TimerId id);
+
+    int     count           ();
+
+    // fires the timers due by now, returns the number fired
+    int     advance         ();
+
+    // milliseconds until advance has work, -1 when no timer is scheduled
+    int     nextTimeout     ();
+
+    void    start           ();
+
+    void    stop            ();
+
+protected:
+    enum { RootBits = 8, LevelBits = 6, Levels = 4, RootSize = 1 << RootBits, LevelSize = 1 << LevelBits };
+
+    struct Entry
+    {
+        Entry*          prev;
+        Entry*          next;
+        int64           expires;    // in ticks
+        int             period;     // in ticks, 0 for one-shot timers
+        TimerHandler    handler;
+        Task*           task;
+        int             index;      // in m_entries
+        uint            generation;
+    };
+
+    // collected under the lock, invoked after it is released
+    struct Fired
+    {
+        TimerHandler    handler;
+        Task*           task;
+    };
+
+    int64   nowTick         ();
+
+    int     toTicks         (int milliseconds);
+
+    TimerId add             (int64 expires, int period, TimerHandler handler, Task* task);
+
+    void    insert          (Entry* entry);
+
+    void    cascade         (int level);
+
+    Entry*  allocate        ();
+
+    void    free            (Entry* entry);
+
+    // the next tick with timers to fire or to cascade, -1 when the wheel is empty
+    int64   nextTick        ();
+
+    void    threadEntry     ();
+
+    static void link        (Entry* head, Entry* entry);
+
+    static void unlink      (Entry* entry);
+
+protected:
+    ThreadPool*             m_pool;
+    int                     m_resolution;
+    int64                   m_origin;       // tickcount_us of tick 0
+    int64                   m_current;      // the next tick to process
+    int                     m_count;
+
+    Entry                   m_root[RootSize];
+    Entry                   m_levels[Levels][LevelSize];
+
+    std::vector<Entry*>     m_entries;      // indexed by the low half of a timer id
+    std::vector<int>        m_free;
+
+    Mutex                   m_lock;
+    Condition               m_cond;
+    Thread                  m_thread;
+    volatile bool           m_running;
+    int64                   m_wakeTick;     // when the sleeping thread wakes up
+};
+
+END_NAMESPACE_LIB
+
+#endif //LIB_TIMER_WHEEL_H
@@ -459,7 +459,7 @@ strings split(const string& value, const char* delims)
 {
     strings result;
     
-    for (uint pos = 0, end = 0; end != string::npos ; pos++)
+    for (size_t pos = 0, end = 0; end != string::npos ; pos++)
     {
         end = value.find_first_of(delims, pos);
         result.push_back(value.substr(pos, end - pos));
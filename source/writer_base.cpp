@@ -25,6 +25,27 @@ void Writer::flush()
     }
 }
 
+void Writer::flush(const iovec* vec, int count)
+{
+    if (m_stream == 0) return;
+
+    std::vector<iovec> vecs;
+    vecs.reserve(count + 1);
+
+    if (m_buf && m_end > 0)
+    {
+        iovec head = { m_buf, (size_t)m_end };
+        vecs.push_back(head);
+    }
+
+    vecs.insert(vecs.end(), vec, vec + count);
+
+    if (!vecs.empty()) m_stream->writevBytes(&vecs[0], vecs.size());
+
+    m_stream->flush();
+    m_end = 0;
+}
+
 void Writer::close()
 {
     bool soError = false;
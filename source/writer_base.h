@@ -28,6 +28,9 @@ public:
 
     virtual void    flush       ();
 
+    // writes the buffered data followed by the vectors in one gather write
+    virtual void    flush       (const iovec* vec, int count);
+
     virtual void    close       ();
 
     virtual void    writeChar   (char value);
@@ -17,6 +17,10 @@ XmlReader::XmlReader(const string& filename) : m_reader(filename.c_str()), m_emp
 {
 }
 
+XmlReader::XmlReader(const void* data, int size) : m_reader(data, 0, size), m_node(XmlNode::None), m_empty(false), m_depth(0)
+{
+}
+
 XmlReader::~XmlReader()
 {
     m_reader.close();
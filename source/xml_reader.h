@@ -13,6 +13,10 @@ public:
     XmlReader (Stream* stream, bool ownStream);
     XmlReader (const string& filename);
     XmlReader (const char* filename);
+
+    // parses the bytes in place, like a mapped file, which have to outlive the reader
+    XmlReader (const void* data, int size);
+
     ~XmlReader();
 
     typedef XmlNode::Type NodeType;